@@ -1,9 +1,13 @@
 #ifndef BASE_H
 #define BASE_H
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <span>
 #include <vector>
 #include <cstdint>
+#include <cstring>
 #include "iostream"
 
 #define TAPERED 1
@@ -26,6 +30,198 @@ struct EvalResult
     tune_t endgame_scale = 1;
 };
 
+struct CoefficientEntry
+{
+    int16_t value;
+    int16_t index;
+};
+
+using sparse_coefficients_t = std::vector<CoefficientEntry>;
+
+// Like EvalResult, but only with the non-zero coefficients, in ascending index order
+struct SparseEvalResult
+{
+    sparse_coefficients_t coefficients;
+    tune_t score;
+    tune_t endgame_scale = 1;
+};
+
+// Sparse results of a batch of positions in one buffer, the coefficients of row i end at row_ends[i] and start
+// where the previous row ends. The caller keeps it between batches, so it stops allocating once it has grown
+struct SparseEvalBatch
+{
+    sparse_coefficients_t coefficients;
+    std::vector<size_t> row_ends;
+    std::vector<tune_t> scores;
+    std::vector<tune_t> endgame_scales;
+
+    size_t size() const
+    {
+        return row_ends.size();
+    }
+
+    void clear()
+    {
+        coefficients.clear();
+        row_ends.clear();
+        scores.clear();
+        endgame_scales.clear();
+    }
+
+    // Closes the row made of the coefficients added since the previous one
+    void end_row(const tune_t score, const tune_t endgame_scale)
+    {
+        row_ends.push_back(coefficients.size());
+        scores.push_back(score);
+        endgame_scales.push_back(endgame_scale);
+    }
+
+    void add_row(const SparseEvalResult& result)
+    {
+        coefficients.insert(coefficients.end(), result.coefficients.begin(), result.coefficients.end());
+        end_row(result.score, result.endgame_scale);
+    }
+
+    std::span<const CoefficientEntry> get_row(const size_t row) const
+    {
+        const auto row_start = row == 0 ? 0 : row_ends[row - 1];
+        return std::span<const CoefficientEntry>(coefficients.data() + row_start, row_ends[row] - row_start);
+    }
+};
+
+// Receives the terms an evaluation fires as (index, count) pairs, the counts of black terms negated. Counts are
+// summed in place and a bit marks each index touched, collecting them afterwards only visits the marked indices
+// in ascending order, so no sort is needed and the cost depends on the number of fired terms
+class TraceSink
+{
+public:
+    explicit TraceSink(const size_t parameter_count) : counts(parameter_count), touched((parameter_count + touched_word_bits - 1) / touched_word_bits) {}
+
+    void add(const int32_t index, const int32_t count)
+    {
+        touched[index / touched_word_bits] |= static_cast<touched_word_t>(1u << (index % touched_word_bits));
+        counts[index] += static_cast<int16_t>(count);
+    }
+
+    // Moves the summed counts into coefficients and leaves the sink empty, terms that cancel out are left out
+    void get_coefficients(sparse_coefficients_t& coefficients)
+    {
+        coefficients.clear();
+        append_coefficients(coefficients);
+    }
+
+    // Like get_coefficients, but adds them after what coefficients already holds
+    void append_coefficients(sparse_coefficients_t& coefficients)
+    {
+        for (size_t word_index = 0; word_index < touched.size(); word_index++)
+        {
+            auto word = static_cast<uint32_t>(touched[word_index]);
+            touched[word_index] = 0;
+            while (word != 0)
+            {
+                const auto index = static_cast<int16_t>(word_index * touched_word_bits + std::countr_zero(word));
+                word &= word - 1;
+                if (counts[index] != 0)
+                {
+                    coefficients.push_back({counts[index], index});
+                    counts[index] = 0;
+                }
+            }
+        }
+    }
+
+private:
+    // 16 bit like the coefficients, so that stores to the sink cannot alias the int, char and bitboard variables
+    // of an evaluation
+    using touched_word_t = uint16_t;
+    static constexpr int32_t touched_word_bits = 16;
+
+    std::vector<int16_t> counts;
+    std::vector<touched_word_t> touched;
+};
+
+// The count of one parameter for one side in a trace, what the evaluation adds to it goes to the sink
+class TraceCounter
+{
+public:
+    TraceCounter(TraceSink& sink, const int32_t index, const int32_t sign) : sink(sink), index(index), sign(sign) {}
+
+    int32_t get_index() const
+    {
+        return index;
+    }
+
+    void operator++(int)
+    {
+        sink.add(index, sign);
+    }
+
+    void operator+=(const int32_t count)
+    {
+        if (count != 0)
+        {
+            sink.add(index, sign * count);
+        }
+    }
+
+private:
+    TraceSink& sink;
+    int32_t index;
+    int32_t sign;
+};
+
+// Stands in for a short[Sizes...][2] trace array: indexing it down to the side gives the counter of a parameter,
+// side 0 counting positive and side 1 negative. Parameters are numbered in row major order from index
+template<int32_t... Sizes>
+class TraceArray;
+
+template<>
+class TraceArray<>
+{
+public:
+    static constexpr int32_t size = 1;
+
+    TraceArray(TraceSink& sink, const int32_t index) : sink(sink), index(index) {}
+
+    TraceCounter operator[](const int32_t side) const
+    {
+        return TraceCounter(sink, index, side == 0 ? 1 : -1);
+    }
+
+    // Index of the first parameter after this array
+    int32_t end() const
+    {
+        return index + size;
+    }
+
+private:
+    TraceSink& sink;
+    int32_t index;
+};
+
+template<int32_t Size, int32_t... Rest>
+class TraceArray<Size, Rest...>
+{
+public:
+    static constexpr int32_t size = Size * TraceArray<Rest...>::size;
+
+    TraceArray(TraceSink& sink, const int32_t index) : sink(sink), index(index) {}
+
+    TraceArray<Rest...> operator[](const int32_t element) const
+    {
+        return TraceArray<Rest...>(sink, index + element * TraceArray<Rest...>::size);
+    }
+
+    int32_t end() const
+    {
+        return index + size;
+    }
+
+private:
+    TraceSink& sink;
+    int32_t index;
+};
+
 #if TAPERED
 enum class PhaseStages
 {
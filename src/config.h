@@ -3,16 +3,46 @@
 
 #include<cstdint>
 #include "engines/altair.h"
+#include "optimizer.h"
 
 #define TAPERED 1
 
 using TuneEval = Altair::AltairEval;
-constexpr int32_t thread_count = 8;
+constexpr int32_t thread_count = 0;
 constexpr double preferred_k = 2.53815; //2.71333; // 3.04511;
 constexpr bool retune_from_zero = true;
 constexpr int32_t max_epoch = 50000;
 constexpr bool enable_qsearch = false;
 constexpr bool print_data_entries = false;
 constexpr int32_t data_load_print_interval = 10000;
+constexpr bool enable_data_cache = true;
+constexpr auto data_cache_directory = ".";
+constexpr bool enable_streaming = false;
+constexpr int64_t streaming_memory_budget_mb = 2048;
+constexpr bool single_precision = false;
+constexpr bool enable_simd = true;
+constexpr bool feature_major_gradient = false;
+constexpr bool pin_threads = false;
+constexpr bool dynamic_work_chunks = false;
+constexpr int64_t mini_batch_size = 0;
+constexpr bool asynchronous_sgd = false;
+// Each entry moves the parameters it uses by async_learning_rate * K / 400 * (wdl - sigmoid) * sigmoid * (1 - sigmoid)
+// * coefficient * phase weight, half the rate times its own squared error gradient. Unlike the Adam learning rate of 1,
+// which moves a parameter about that many centipawns per step whatever the gradient, this scales the raw gradient:
+// with sigmoid * (1 - sigmoid) <= 1/4 and K / 400 near 1/160, one entry moves a parameter by a few thousandths of
+// a centipawn, and an epoch makes one such update per entry instead of one step over the data set
+constexpr double async_learning_rate = 3;
+constexpr OptimizerType optimizer_type = OptimizerType::Adam;
+constexpr bool gauss_newton_full_matrix = true;
+constexpr bool least_squares_warm_start = false;
+constexpr double warm_start_wdl_clip = 0.1;
+constexpr int32_t convergence_window = 0;
+constexpr double min_relative_improvement = 1e-7;
+constexpr double convergence_gradient_norm = 0;
+constexpr double convergence_max_change = 0;
+constexpr int32_t rounded_stable_epochs = 0;
+constexpr double max_tune_seconds = 0;
+constexpr int32_t lr_plateau_patience = 0;
+constexpr double lr_plateau_ratio = 0.5;
 
 #endif // !CONFIG_H
@@ -0,0 +1,157 @@
+#include "data_cache.h"
+#include "config.h"
+#include "entry_file.h"
+
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace Tuner;
+
+class KeyHasher
+{
+public:
+    void add(const void* data, const size_t size)
+    {
+        const auto bytes = static_cast<const uint8_t*>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    template<typename T>
+    void add_value(const T& value)
+    {
+        add(&value, sizeof(T));
+    }
+
+    void add_string(const string& value)
+    {
+        add_value(value.size());
+        add(value.data(), value.size());
+    }
+
+    uint64_t get() const
+    {
+        return hash;
+    }
+
+private:
+    uint64_t hash = 14695981039346656037ULL;
+};
+
+bool Tuner::can_cache_sources(const vector<DataSource>& sources)
+{
+    for (const auto& source : sources)
+    {
+        error_code error;
+        if (!filesystem::is_regular_file(source.path, error))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Identifies the source list alone, which stays the same while the data in it or the evaluation change
+static uint64_t get_source_list_key(const vector<DataSource>& sources)
+{
+    KeyHasher hasher;
+    hasher.add_value(sources.size());
+    for (const auto& source : sources)
+    {
+        hasher.add_string(source.path);
+        hasher.add_value(source.side_to_move_wdl);
+        hasher.add_value(source.position_limit);
+    }
+    return hasher.get();
+}
+
+uint64_t Tuner::get_data_cache_key(const vector<DataSource>& sources, const parameters_t& parameters)
+{
+    KeyHasher hasher;
+    hasher.add_value(entry_file_version);
+    hasher.add_value(static_cast<uint32_t>(TAPERED));
+    hasher.add_value(static_cast<uint32_t>(sizeof(tune_t)));
+    hasher.add_value(enable_qsearch);
+    hasher.add_value(TuneEval::includes_additional_score);
+    hasher.add_value(TuneEval::trace_version);
+
+    // The values only reach the entries through the qsearch and the additional scores
+    hasher.add_value(parameters.size());
+    if constexpr (enable_qsearch || TuneEval::includes_additional_score)
+    {
+        hasher.add(parameters.data(), parameters.size() * sizeof(parameters[0]));
+    }
+
+    hasher.add_value(sources.size());
+    for (const auto& source : sources)
+    {
+        hasher.add_string(source.path);
+        hasher.add_value(source.side_to_move_wdl);
+        hasher.add_value(source.position_limit);
+
+        error_code error;
+        const auto file_size = filesystem::file_size(source.path, error);
+        hasher.add_value(error ? uintmax_t{0} : file_size);
+        const auto write_time = filesystem::last_write_time(source.path, error);
+        hasher.add_value(error ? int64_t{0} : static_cast<int64_t>(write_time.time_since_epoch().count()));
+    }
+
+    return hasher.get();
+}
+
+string Tuner::get_data_cache_path(const vector<DataSource>& sources, const uint64_t key)
+{
+    stringstream ss;
+    ss << "tuner-" << hex << setfill('0') << setw(16) << get_source_list_key(sources) << "-" << setw(16) << key << ".cache";
+    return (filesystem::path(data_cache_directory) / ss.str()).string();
+}
+
+void Tuner::remove_superseded_data_caches(const string& path)
+{
+    const filesystem::path cache_path(path);
+    const auto cache_name = cache_path.filename().string();
+    // "tuner-<source list key>-", what the names of every cache of the same source list start with
+    const auto prefix = cache_name.substr(0, cache_name.size() - string_view("0000000000000000.cache").size());
+    const auto directory = cache_path.has_parent_path() ? cache_path.parent_path() : filesystem::path(".");
+
+    error_code error;
+    for (filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error))
+    {
+        const auto name = it->path().filename().string();
+        if (name != cache_name && name.starts_with(prefix) && name.ends_with(".cache"))
+        {
+            error_code remove_error;
+            if (filesystem::remove(it->path(), remove_error))
+            {
+                cout << "Removed superseded data cache " << it->path().string() << endl;
+            }
+        }
+    }
+}
+
+bool Tuner::load_data_cache(const string& path, const uint64_t key, EntrySet& entries)
+{
+    return read_entry_file(path, key, entries);
+}
+
+void Tuner::save_data_cache(const string& path, const uint64_t key, const EntrySet& entries)
+{
+    EntryFileWriter writer;
+    if (!writer.open(path, key))
+    {
+        cout << "Failed to create data cache " << path << endl;
+        return;
+    }
+
+    writer.write(entries);
+    if (writer.close())
+    {
+        remove_superseded_data_caches(path);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef DATA_CACHE_H
+#define DATA_CACHE_H 1
+
+#include "base.h"
+#include "dataset.h"
+#include "tuner.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Tuner
+{
+    // Only regular files can be cached, pipes have no size or modification time to detect changes with
+    bool can_cache_sources(const std::vector<DataSource>& sources);
+    // Identifies a loaded dataset by its sources and by the parameter layout and values of TuneEval,
+    // since both the coefficients and the additional scores depend on them
+    uint64_t get_data_cache_key(const std::vector<DataSource>& sources, const parameters_t& parameters);
+    // Caches of the same source list share the start of their names, so a new one can replace the earlier ones
+    std::string get_data_cache_path(const std::vector<DataSource>& sources, uint64_t key);
+    // Removes the other caches of the source list of the cache at path, which can never be loaded again
+    void remove_superseded_data_caches(const std::string& path);
+
+    bool load_data_cache(const std::string& path, uint64_t key, EntrySet& entries);
+    void save_data_cache(const std::string& path, uint64_t key, const EntrySet& entries);
+}
+
+#endif // !DATA_CACHE_H
@@ -0,0 +1,90 @@
+#include "dataset.h"
+
+#include <limits>
+
+using namespace std;
+
+size_t EntrySet::size() const
+{
+    return headers.size();
+}
+
+void EntrySet::clear()
+{
+    coefficients.clear();
+    offsets.assign(1, 0);
+    headers.clear();
+}
+
+void EntrySet::reserve(const size_t entry_count, const size_t coefficient_count)
+{
+    coefficients.reserve(coefficient_count);
+    offsets.reserve(entry_count + 1);
+    headers.reserve(entry_count);
+}
+
+void EntrySet::append(const EntrySet& other)
+{
+    const auto coefficient_base = coefficients.size();
+    coefficients.insert(coefficients.end(), other.coefficients.begin(), other.coefficients.end());
+    for (size_t i = 1; i < other.offsets.size(); i++)
+    {
+        offsets.push_back(coefficient_base + other.offsets[i]);
+    }
+
+    headers.insert(headers.end(), other.headers.begin(), other.headers.end());
+}
+
+size_t TransposedEntrySet::parameter_count() const
+{
+    return offsets.empty() ? 0 : offsets.size() - 1;
+}
+
+// Two passes over the entries, the first sizes each parameter row and the second encodes into it. Entries are
+// visited in order, so every row comes out sorted by entry index without any temporary storage
+void TransposedEntrySet::build(const EntrySet& entries, const size_t parameter_count)
+{
+    vector<uint32_t> previous_entries;
+    const auto for_each_coefficient = [&](const auto& coefficient_handler)
+    {
+        previous_entries.assign(parameter_count, numeric_limits<uint32_t>::max());
+        for (size_t entry_index = 0; entry_index < entries.size(); entry_index++)
+        {
+            const auto coefficients_begin = entries.coefficients.data() + entries.offsets[entry_index];
+            const auto coefficients_end = entries.coefficients.data() + entries.offsets[entry_index + 1];
+            decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t index)
+            {
+                const auto entry_gap = static_cast<uint32_t>(entry_index) - previous_entries[index] - 1;
+                previous_entries[index] = static_cast<uint32_t>(entry_index);
+                coefficient_handler(static_cast<int16_t>(value), index, entry_gap);
+            });
+        }
+    };
+
+    offsets.assign(parameter_count + 1, 0);
+    for_each_coefficient([&](const int16_t value, const int32_t index, const uint32_t entry_gap)
+    {
+        offsets[index + 1] += get_encoded_coefficient_size(value, entry_gap);
+    });
+    for (size_t parameter_index = 0; parameter_index < parameter_count; parameter_index++)
+    {
+        offsets[parameter_index + 1] += offsets[parameter_index];
+    }
+
+    coefficients.resize(offsets[parameter_count]);
+    vector<uint8_t*> row_ends(parameter_count);
+    for (size_t parameter_index = 0; parameter_index < parameter_count; parameter_index++)
+    {
+        row_ends[parameter_index] = coefficients.data() + offsets[parameter_index];
+    }
+    for_each_coefficient([&](const int16_t value, const int32_t index, const uint32_t entry_gap)
+    {
+        encode_coefficient(row_ends[index], value, entry_gap);
+    });
+}
+
+void TransposedEntrySet::clear()
+{
+    coefficients.clear();
+    offsets.clear();
+}
@@ -0,0 +1,199 @@
+#ifndef DATASET_H
+#define DATASET_H 1
+
+#include "base.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Default initializes instead of value initializing, so resizing a buffer of trivial elements leaves them
+// uninitialized. The pages of a fresh buffer are then first touched by whichever thread fills them
+template<typename T>
+struct UninitializedAllocator : std::allocator<T>
+{
+    template<typename U>
+    struct rebind
+    {
+        using other = UninitializedAllocator<U>;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template<typename U>
+    void construct(U* pointer) noexcept(std::is_nothrow_default_constructible_v<U>)
+    {
+        ::new (static_cast<void*>(pointer)) U;
+    }
+
+    template<typename U, typename... Args>
+    void construct(U* pointer, Args&&... args)
+    {
+        ::new (static_cast<void*>(pointer)) U(std::forward<Args>(args)...);
+    }
+};
+
+template<typename T>
+using entry_buffer_t = std::vector<T, UninitializedAllocator<T>>;
+
+// Coefficients of an entry are encoded in ascending index order. Each one is a value byte followed by the gap
+// to the previous index as a varint. Values outside of the int8 range are stored as an escape byte and 16 bits
+constexpr uint8_t coefficient_value_escape = 0x80;
+
+inline size_t get_encoded_coefficient_size(const int16_t value, uint32_t index_gap)
+{
+    size_t size = value > -128 && value < 128 ? 2 : 4;
+    while (index_gap >= 0x80)
+    {
+        size++;
+        index_gap >>= 7;
+    }
+    return size;
+}
+
+// Writes the coefficient to data and advances data past it
+inline void encode_coefficient(uint8_t*& data, const int16_t value, uint32_t index_gap)
+{
+    if (value > -128 && value < 128)
+    {
+        *data++ = static_cast<uint8_t>(value);
+    }
+    else
+    {
+        const auto bits = static_cast<uint16_t>(value);
+        *data++ = coefficient_value_escape;
+        *data++ = static_cast<uint8_t>(bits);
+        *data++ = static_cast<uint8_t>(bits >> 8);
+    }
+
+    while (index_gap >= 0x80)
+    {
+        *data++ = static_cast<uint8_t>(index_gap | 0x80);
+        index_gap >>= 7;
+    }
+    *data++ = static_cast<uint8_t>(index_gap);
+}
+
+inline void encode_coefficient(entry_buffer_t<uint8_t>& encoded, const int16_t value, const uint32_t index_gap)
+{
+    const auto encoded_size = encoded.size();
+    encoded.resize(encoded_size + get_encoded_coefficient_size(value, index_gap));
+    auto data = encoded.data() + encoded_size;
+    encode_coefficient(data, value, index_gap);
+}
+
+// Decodes the coefficient at data and advances data past it
+inline void decode_coefficient(const uint8_t*& data, int32_t& value, uint32_t& index_gap)
+{
+    value = static_cast<int8_t>(*data++);
+    // The rare paths are kept as unlikely branches, so the pointer advance never turns into a dependency chain
+    if (value == static_cast<int8_t>(coefficient_value_escape)) [[unlikely]]
+    {
+        value = static_cast<int16_t>(data[0] | (data[1] << 8));
+        data += 2;
+    }
+
+    index_gap = *data++;
+    if (index_gap & 0x80) [[unlikely]]
+    {
+        index_gap &= 0x7F;
+        uint32_t shift = 7;
+        uint8_t byte;
+        do
+        {
+            byte = *data++;
+            index_gap |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+    }
+}
+
+// Calls coefficient_handler(value, index) for every coefficient in the encoded range
+template<typename F>
+inline void decode_coefficients(const uint8_t* data, const uint8_t* end, F&& coefficient_handler)
+{
+    int32_t index = -1;
+    while (data != end)
+    {
+        int32_t value;
+        uint32_t index_gap;
+        decode_coefficient(data, value, index_gap);
+        index += static_cast<int32_t>(index_gap) + 1;
+        coefficient_handler(value, index);
+    }
+}
+
+// The wdl of an entry is stored in fixed point, which keeps 0, 0.5 and 1 exact
+constexpr tune_t wdl_quantization_scale = 32768;
+
+inline uint16_t quantize_wdl(const tune_t wdl)
+{
+    return static_cast<uint16_t>(std::lround(std::clamp<tune_t>(wdl, 0, 1) * wdl_quantization_scale));
+}
+
+// Per position data read by the hot loops, packed next to each other. The phase and endgame scale are
+// folded into the weights, so the eval of an entry is additional_score + midgame * midgame_weight + endgame * endgame_weight
+struct EntryHeader
+{
+    tune_t additional_score;
+#if TAPERED
+    tune_t midgame_weight;
+    tune_t endgame_weight;
+#endif
+    uint16_t wdl;
+    uint8_t white_to_move;
+    uint8_t padding[5];
+
+    tune_t get_wdl() const
+    {
+        return wdl / wdl_quantization_scale;
+    }
+};
+
+inline EntryHeader make_entry_header(const tune_t wdl, const bool white_to_move, const int32_t phase, const tune_t endgame_scale)
+{
+    EntryHeader header{};
+    header.additional_score = 0;
+#if TAPERED
+    header.midgame_weight = phase / static_cast<tune_t>(24);
+    header.endgame_weight = (24 - phase) / static_cast<tune_t>(24) * endgame_scale;
+#endif
+    header.wdl = quantize_wdl(wdl);
+    header.white_to_move = white_to_move;
+    return header;
+}
+
+// Entries in compressed sparse row form. The encoded coefficients of entry i are the bytes
+// coefficients[offsets[i]] up to coefficients[offsets[i + 1]] and its header is headers[i]
+struct EntrySet
+{
+    entry_buffer_t<uint8_t> coefficients;
+    entry_buffer_t<uint64_t> offsets = {0};
+    entry_buffer_t<EntryHeader> headers;
+
+    size_t size() const;
+    void clear();
+    void reserve(size_t entry_count, size_t coefficient_count);
+    void append(const EntrySet& other);
+};
+
+// The coefficients of an entry set in compressed sparse column form, one encoded row per parameter listing the
+// entries that use it. Rows use the entry encoding with entry index gaps in place of parameter index gaps, so
+// the row of parameter i is the bytes coefficients[offsets[i]] up to coefficients[offsets[i + 1]]
+struct TransposedEntrySet
+{
+    entry_buffer_t<uint8_t> coefficients;
+    entry_buffer_t<uint64_t> offsets;
+
+    size_t parameter_count() const;
+    void build(const EntrySet& entries, size_t parameter_count);
+    void clear();
+};
+
+#endif // !DATASET_H
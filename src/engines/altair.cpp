@@ -11,8 +11,10 @@
 #include <array>
 #include <string>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #include <iomanip>
+#include <cmath>
 
 using namespace std;
 using namespace Altair;
@@ -23,36 +25,6 @@ using namespace Altair;
 
 
 
-template <typename Out>
-void split(const std::string &s, char delim, Out result) {
-    std::istringstream iss(s);
-    std::string item;
-    while (std::getline(iss, item, delim)) {
-        *result++ = item;
-    }
-}
-
-
-std::vector<std::string> split(const std::string &s, char delim) {
-    std::vector<std::string> elems;
-    split(s, delim, std::back_inserter(elems));
-    return elems;
-}
-
-
-Piece piece_to_num(char piece) {
-
-    auto it = std::find(std::begin(PIECE_MATCHER), std::end(PIECE_MATCHER), piece);
-    return static_cast<Piece>(it - std::begin(PIECE_MATCHER));
-}
-
-bool is_number(const std::string& s)
-{
-    return !s.empty() && std::find_if(s.begin(),
-                                      s.end(), [](unsigned char c) { return !std::isdigit(c); }) == s.end();
-}
-
-
 BITBOARD Position::get_pieces(Piece piece) const {
     return pieces[piece];
 }
@@ -100,80 +72,34 @@ void Position::place_piece(Piece piece, Square square) {
     board[square] = piece;
 }
 
-PLY_TYPE Position::set_fen(const std::string& fen_string) {
-
-    //std::string reduced_fen_string = std::regex_replace(fen_string, std::regex("^ +| +$|( ) +"), "$1");
-    std::vector<std::string> fen_tokens = split(fen_string, ' ');
-
-    //if (fen_tokens.size() < 4) {
-    //    throw std::invalid_argument( "Fen is incorrect" );
-    //}
-
-    const std::string position = fen_tokens[0];
-    const std::string player = fen_tokens[1];
-    const std::string castling = fen_tokens[2];
-    const std::string en_passant = fen_tokens[3];
-
-    std::string half_move_clock = fen_tokens.size() >= 5 ? fen_tokens[4] : "0";
-    //std::string full_move_counter = fen_tokens.size() >= 6 ? fen_tokens[5] : "1";
-
-    if (!is_number(half_move_clock)) half_move_clock = "0";
-    //if (!is_number(full_move_counter)) full_move_counter = "0";
-
-    side = (player == "w") ? WHITE : BLACK;
-
+void Position::set_board(const ParsedFen& fen) {
+    // The parsed piece numbering is the same as ours, with EMPTY for empty squares
     for (int piece = WHITE_PAWN; piece != EMPTY; piece++) {
-        pieces[piece] = 0ULL;
-    }
-
-    auto pos = static_cast<Square>(56);
-
-    // Parsing the main 8x8 board part while adding appropriate padding
-    for (char c : position) {
-        if (c == '/' ) {
-            pos = static_cast<Square>(pos - 16);
-        } else if (std::isdigit(c)) {
-
-            for (int empty_amt = 0; empty_amt < c - '0'; empty_amt++) {
-                board[pos] = EMPTY;
-                pos = static_cast<Square>(pos + 1);
-            }
-
-        }
-        else if (std::isalpha(c)) {
-
-            Piece piece = piece_to_num(c);
-            place_piece(piece, pos);
-
-            pos = static_cast<Square>(pos + 1);
-
-        }
+        pieces[piece] = fen.pieces[piece];
     }
 
-    castle_ability_bits = 0;
-    for (char c : castling) {
-
-        if (c == 'K') castle_ability_bits |= 1;
-        else if (c == 'Q') castle_ability_bits |= 2;
-        else if (c == 'k') castle_ability_bits |= 4;
-        else if (c == 'q') castle_ability_bits |= 8;
-
+    for (int square = 0; square < 64; square++) {
+        board[square] = static_cast<Piece>(fen.board[square]);
     }
 
-    if (en_passant.size() > 1) {
-        auto square = static_cast<Square>((en_passant[1] - '1') * 8 + en_passant[0] - 'a');
-        ep_square = square;
-    }
-    else {
-        ep_square = NO_SQUARE;
-    }
+    side = fen.white_to_move ? WHITE : BLACK;
+    castle_ability_bits = fen.castling;
+    ep_square = fen.en_passant_square == fen_no_square ? NO_SQUARE : static_cast<Square>(fen.en_passant_square);
 
     our_pieces = get_our_pieces();
     opp_pieces = get_opp_pieces();
     all_pieces = get_all_pieces();
     empty_squares = get_empty_squares();
+}
 
-    return static_cast<PLY_TYPE>(std::stoi(half_move_clock));
+PLY_TYPE Position::set_fen(const std::string& fen_string) {
+    ParsedFen fen;
+    if (!parse_fen(fen_string, fen)) {
+        throw std::invalid_argument("Fen is incorrect");
+    }
+
+    set_board(fen);
+    return static_cast<PLY_TYPE>(fen.half_move_clock);
 }
 
 
@@ -249,8 +175,49 @@ Square get_black_relative_square(Square square, Color color) {
     return static_cast<Square>(square ^ (~color * 56));
 }
 
-SCORE_TYPE evaluate_king_pawn(const Position& position, File file, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
-    SCORE_TYPE score = 0;
+// Score mode keeps the midgame and endgame sums of the tuned values apart, they are only tapered at the end
+struct TunedScore {
+    tune_t midgame = 0;
+    tune_t endgame = 0;
+
+    TunedScore& operator+=(const TunedScore& other) {
+        midgame += other.midgame;
+        endgame += other.endgame;
+        return *this;
+    }
+
+    TunedScore& operator-=(const TunedScore& other) {
+        midgame -= other.midgame;
+        endgame -= other.endgame;
+        return *this;
+    }
+};
+
+// What the terms of one side are summed into, and what the evaluation returns
+template<EvalMode mode>
+using mode_score_t = std::conditional_t<mode == EvalMode::Score, TunedScore, SCORE_TYPE>;
+
+template<EvalMode mode>
+using mode_evaluation_t = std::conditional_t<mode == EvalMode::Score, tune_t, SCORE_TYPE>;
+
+// Adds count times a term to the score of one side and to the trace, as far as the mode computes either of them.
+// Score mode adds the tuned value of the parameter of the term instead of its engine constant
+template<EvalMode mode>
+void add_term(mode_score_t<mode>& score, const Trace& trace, SCORE_TYPE constant, TraceCounter counter, int count = 1) {
+    if constexpr (mode == EvalMode::Score) {
+        const pair_t& value = trace.parameters[counter.get_index()];
+        score.midgame += count * value[static_cast<int32_t>(PhaseStages::Midgame)];
+        score.endgame += count * value[static_cast<int32_t>(PhaseStages::Endgame)];
+    }
+    else {
+        if constexpr (mode != EvalMode::Trace) score += count * constant;
+        counter += count;
+    }
+}
+
+template<EvalMode mode>
+mode_score_t<mode> evaluate_king_pawn(const Position& position, File file, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
+    mode_score_t<mode> score{};
 
 
     BITBOARD our_file_pawns = evaluation_information.pawns[color] & MASK_FILE[file];
@@ -261,8 +228,7 @@ SCORE_TYPE evaluate_king_pawn(const Position& position, File file, Color color,
 
     int index = square == NO_SQUARE ? 4 : std::min(static_cast<int>(relative_rank) - 1, 3);
 
-    score += KING_PAWN_SHIELD[index][file];
-    trace.king_pawn_shield[index][file][color]++;
+    add_term<mode>(score, trace, KING_PAWN_SHIELD[index][file], trace.king_pawn_shield[index][file][color]);
 
     // PAWN STORM
     BITBOARD opp_file_pawns = evaluation_information.pawns[~color] & MASK_FILE[file];
@@ -274,17 +240,17 @@ SCORE_TYPE evaluate_king_pawn(const Position& position, File file, Color color,
     // Uses the relative ranks 2-7 (ranks 6 & 7 are combined into one index)
     index = square == NO_SQUARE ? 5 : std::min(static_cast<int>(relative_rank) - 1, 4);
 
-    score += KING_PAWN_STORM[index][file];
-    trace.king_pawn_storm[index][file][color]++;
+    add_term<mode>(score, trace, KING_PAWN_STORM[index][file], trace.king_pawn_storm[index][file][color]);
 
     return score;
 }
 
-SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
+template<EvalMode mode>
+mode_score_t<mode> evaluate_pawns(Position& position, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
 
     Direction up = color == WHITE ? NORTH : SOUTH;
 
-    SCORE_TYPE score = 0;
+    mode_score_t<mode> score{};
     BITBOARD our_pawns = evaluation_information.pawns[color];
     BITBOARD opp_pawns = evaluation_information.pawns[~color];
     BITBOARD phalanx_pawns = our_pawns & shift<WEST>(our_pawns);
@@ -292,8 +258,7 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
 
     // Doubled Pawns
     BITBOARD doubled_pawns = our_pawns & shift(up, our_pawns);
-    score += static_cast<SCORE_TYPE>(popcount(doubled_pawns)) * DOUBLED_PAWN_PENALTY;
-    trace.doubled_pawn_penalty[color] += popcount(doubled_pawns);
+    add_term<mode>(score, trace, DOUBLED_PAWN_PENALTY, trace.doubled_pawn_penalty[color], popcount(doubled_pawns));
 
     // KING RING ATTACKS
     BITBOARD king_ring_attacks_1 = evaluation_information.pawn_attacks[color] &
@@ -301,11 +266,8 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
     BITBOARD king_ring_attacks_2 = evaluation_information.pawn_attacks[color] &
             king_ring_zone.masks[1][evaluation_information.king_squares[~color]];
 
-    score += static_cast<SCORE_TYPE>(popcount(king_ring_attacks_1)) * KING_RING_ATTACKS[0][PAWN];
-    score += static_cast<SCORE_TYPE>(popcount(king_ring_attacks_2)) * KING_RING_ATTACKS[1][PAWN];
-
-    trace.king_ring_attacks[0][PAWN][color] += popcount(king_ring_attacks_1);
-    trace.king_ring_attacks[1][PAWN][color] += popcount(king_ring_attacks_2);
+    add_term<mode>(score, trace, KING_RING_ATTACKS[0][PAWN], trace.king_ring_attacks[0][PAWN][color], popcount(king_ring_attacks_1));
+    add_term<mode>(score, trace, KING_RING_ATTACKS[1][PAWN], trace.king_ring_attacks[1][PAWN][color], popcount(king_ring_attacks_2));
 
     evaluation_information.total_king_ring_attacks[color] +=
             static_cast<int>(2 * popcount(king_ring_attacks_1) + popcount(king_ring_attacks_2));
@@ -318,11 +280,10 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
         Square black_relative_square = get_black_relative_square(square, color);
         Rank relative_rank = rank_of(get_white_relative_square(square, color));
 
-        score += PIECE_VALUES[PAWN];
-        trace.piece_values[PAWN][color]++;
+        add_term<mode>(score, trace, PIECE_VALUES[PAWN], trace.piece_values[PAWN][color]);
 
-        score += PIECE_SQUARE_TABLES[PAWN][black_relative_square];
-        trace.piece_square_tables[PAWN][black_relative_square][color]++;
+        add_term<mode>(score, trace, PIECE_SQUARE_TABLES[PAWN][black_relative_square],
+                       trace.piece_square_tables[PAWN][black_relative_square][color]);
 
         // evaluation_information.game_phase += GAME_PHASE_SCORES[PAWN];
         evaluation_information.piece_counts[color][PAWN]++;
@@ -331,25 +292,25 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
         if (!(passed_pawn_masks[color][square] & opp_pawns)) {
             auto protectors = popcount(evaluation_information.pawns[color] & get_piece_attacks(get_piece(PAWN, ~color), square, 0));
 
-            score += PASSED_PAWN_BONUSES[protectors][relative_rank];
-            trace.passed_pawn_bonuses[protectors][relative_rank][color]++;
+            add_term<mode>(score, trace, PASSED_PAWN_BONUSES[protectors][relative_rank],
+                           trace.passed_pawn_bonuses[protectors][relative_rank][color]);
             evaluation_information.passed_pawn_count[color]++;
 
             // BLOCKERS
             auto blocker_square = square + up;
             if (from_square(blocker_square) & evaluation_information.pieces[~color]) {
-                score += PASSED_PAWN_BLOCKERS[get_piece_type(position.board[blocker_square], ~color)][rank_of(
-                        get_white_relative_square(blocker_square, color))];
-                trace.passed_pawn_blockers[get_piece_type(position.board[blocker_square], ~color)][rank_of(
-                        get_white_relative_square(blocker_square, color))][color]++;
+                PieceType blocker = get_piece_type(position.board[blocker_square], ~color);
+                Rank blocker_rank = rank_of(get_white_relative_square(blocker_square, color));
+                add_term<mode>(score, trace, PASSED_PAWN_BLOCKERS[blocker][blocker_rank],
+                               trace.passed_pawn_blockers[blocker][blocker_rank][color]);
             }
 
             auto blocker_square_2 = blocker_square + up;
             if (relative_rank <= 5 && from_square(blocker_square_2) & evaluation_information.pieces[~color]) {
-                score += PASSED_PAWN_BLOCKERS_2[get_piece_type(position.board[blocker_square_2], ~color)][rank_of(
-                        get_white_relative_square(blocker_square_2, color))];
-                trace.passed_pawn_blockers_2[get_piece_type(position.board[blocker_square_2], ~color)][rank_of(
-                        get_white_relative_square(blocker_square_2, color))][color]++;
+                PieceType blocker = get_piece_type(position.board[blocker_square_2], ~color);
+                Rank blocker_rank = rank_of(get_white_relative_square(blocker_square_2, color));
+                add_term<mode>(score, trace, PASSED_PAWN_BLOCKERS_2[blocker][blocker_rank],
+                               trace.passed_pawn_blockers_2[blocker][blocker_rank][color]);
             }
 
             // Square of the Pawn
@@ -358,18 +319,15 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
             int promotion_king_distance = get_chebyshev_distance(evaluation_information.king_squares[~color], promotion_square);
 
             if (std::min(promotion_distance, 5) < promotion_king_distance - (position.side != color)) {
-                score += SQUARE_OF_THE_PAWN;
-                trace.square_of_the_pawn[color]++;
+                add_term<mode>(score, trace, SQUARE_OF_THE_PAWN, trace.square_of_the_pawn[color]);
             }
 
             // Passed King Distances
             int our_king_distance = get_chebyshev_distance(square, evaluation_information.king_squares[ color]);
             int opp_king_distance = get_chebyshev_distance(square, evaluation_information.king_squares[~color]);
 
-            score += our_king_distance * PASSED_OUR_DISTANCE[relative_rank];
-            score += opp_king_distance * PASSED_OPP_DISTANCE[relative_rank];
-            trace.passed_our_distance[relative_rank][color] += our_king_distance;
-            trace.passed_opp_distance[relative_rank][color] += opp_king_distance;
+            add_term<mode>(score, trace, PASSED_OUR_DISTANCE[relative_rank], trace.passed_our_distance[relative_rank][color], our_king_distance);
+            add_term<mode>(score, trace, PASSED_OPP_DISTANCE[relative_rank], trace.passed_opp_distance[relative_rank][color], opp_king_distance);
         }
 
         BITBOARD isolated_pawn_mask = fill<SOUTH>(fill<NORTH>(shift<WEST>(bb_square) | shift<EAST>(bb_square)));
@@ -380,8 +338,7 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
 
         // ISOLATED PAWN
         if (!(isolated_pawn_mask & evaluation_information.pawns[color])) {
-            score += ISOLATED_PAWN_PENALTY;
-            trace.isolated_pawn_penalty[color]++;
+            add_term<mode>(score, trace, ISOLATED_PAWN_PENALTY, trace.isolated_pawn_penalty[color]);
         }
 
         // BACKWARDS PAWN
@@ -391,8 +348,7 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
                  (from_square(square + up) & evaluation_information.pawn_attacks[~color])) {
 
             bool open = !(fill(up, bb_square) & evaluation_information.pawns[~color]);
-            score += BACKWARDS_PAWN_PENALTY[open];
-            trace.backwards_pawn_penalty[open][color]++;
+            add_term<mode>(score, trace, BACKWARDS_PAWN_PENALTY[open], trace.backwards_pawn_penalty[open][color]);
         }
     }
 
@@ -401,38 +357,36 @@ SCORE_TYPE evaluate_pawns(Position& position, Color color, EvaluationInformation
         Square square = poplsb(phalanx_pawns);
         Rank relative_rank = rank_of(get_white_relative_square(square, color));
 
-        score += PHALANX_PAWN_BONUSES[relative_rank];
-        trace.phalanx_pawn_bonuses[relative_rank][color]++;
+        add_term<mode>(score, trace, PHALANX_PAWN_BONUSES[relative_rank], trace.phalanx_pawn_bonuses[relative_rank][color]);
     }
 
     while (pawn_threats) {
         Square square = poplsb(pawn_threats);
-        score += PIECE_THREATS[PAWN][get_piece_type(position.board[square], ~color)];
-        trace.piece_threats[PAWN][get_piece_type(position.board[square], ~color)][color]++;
+        PieceType threatened = get_piece_type(position.board[square], ~color);
+        add_term<mode>(score, trace, PIECE_THREATS[PAWN][threatened], trace.piece_threats[PAWN][threatened][color]);
     }
 
     return score;
 }
 
-template<PieceType piece_type>
-SCORE_TYPE evaluate_piece(Position& position, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
-    SCORE_TYPE score = 0;
+template<EvalMode mode, PieceType piece_type>
+mode_score_t<mode> evaluate_piece(Position& position, Color color, EvaluationInformation& evaluation_information, Trace& trace) {
+    mode_score_t<mode> score{};
     BITBOARD pieces = position.get_pieces(piece_type, color);
 
     if constexpr (piece_type == BISHOP) {
         if (popcount(pieces) >= 2) {
-            score += BISHOP_PAIR_BONUS;
-            trace.bishop_pair_bonus[color]++;
+            add_term<mode>(score, trace, BISHOP_PAIR_BONUS, trace.bishop_pair_bonus[color]);
         }
     }
 
     while (pieces) {
         Square square = poplsb(pieces);
-        score += PIECE_VALUES[piece_type];
-        trace.piece_values[piece_type][color]++;
+        add_term<mode>(score, trace, PIECE_VALUES[piece_type], trace.piece_values[piece_type][color]);
 
-        score += PIECE_SQUARE_TABLES[piece_type][get_black_relative_square(square, color)];
-        trace.piece_square_tables[piece_type][get_black_relative_square(square, color)][color]++;
+        Square black_relative_square = get_black_relative_square(square, color);
+        add_term<mode>(score, trace, PIECE_SQUARE_TABLES[piece_type][black_relative_square],
+                       trace.piece_square_tables[piece_type][black_relative_square][color]);
 
         evaluation_information.game_phase += GAME_PHASE_SCORES[piece_type];
         evaluation_information.piece_counts[color][piece_type]++;
@@ -446,42 +400,37 @@ SCORE_TYPE evaluate_piece(Position& position, Color color, EvaluationInformation
                     (~evaluation_information.pieces[color]) &
                     (~evaluation_information.pawn_attacks[~color]);
 
-            score += MOBILITY_VALUES[piece_type - 1][popcount(mobility)];
-            trace.mobility_values[piece_type - 1][popcount(mobility)][color]++;
+            add_term<mode>(score, trace, MOBILITY_VALUES[piece_type - 1][popcount(mobility)],
+                           trace.mobility_values[piece_type - 1][popcount(mobility)][color]);
 
             // KING RING ATTACKS
             BITBOARD king_ring_attacks_1 = piece_attacks & king_ring_zone.masks[0][evaluation_information.king_squares[~color]];
             BITBOARD king_ring_attacks_2 = piece_attacks & king_ring_zone.masks[1][evaluation_information.king_squares[~color]];
 
-            score += static_cast<SCORE_TYPE>(popcount(king_ring_attacks_1)) * KING_RING_ATTACKS[0][piece_type];
-            score += static_cast<SCORE_TYPE>(popcount(king_ring_attacks_2)) * KING_RING_ATTACKS[1][piece_type];
-
-            trace.king_ring_attacks[0][piece_type][color] += popcount(king_ring_attacks_1);
-            trace.king_ring_attacks[1][piece_type][color] += popcount(king_ring_attacks_2);
+            add_term<mode>(score, trace, KING_RING_ATTACKS[0][piece_type], trace.king_ring_attacks[0][piece_type][color],
+                           popcount(king_ring_attacks_1));
+            add_term<mode>(score, trace, KING_RING_ATTACKS[1][piece_type], trace.king_ring_attacks[1][piece_type][color],
+                           popcount(king_ring_attacks_2));
 
             evaluation_information.total_king_ring_attacks[color] +=
                     static_cast<int>(2 * popcount(king_ring_attacks_1) + popcount(king_ring_attacks_2));
 
             // OPPONENT KING TROPISM
             int distance_to_opp_king = get_manhattan_distance(square, evaluation_information.king_squares[~color]);
-            score += OPP_KING_TROPISM[piece_type] * distance_to_opp_king;
-            trace.opp_king_tropism[piece_type][color] += distance_to_opp_king;
+            add_term<mode>(score, trace, OPP_KING_TROPISM[piece_type], trace.opp_king_tropism[piece_type][color], distance_to_opp_king);
 
             // OUR KING TROPISM
             int distance_to_our_king = get_manhattan_distance(square, evaluation_information.king_squares[color]);
-            score += OUR_KING_TROPISM[piece_type] * distance_to_our_king;
-            trace.our_king_tropism[piece_type][color] += distance_to_our_king;
+            add_term<mode>(score, trace, OUR_KING_TROPISM[piece_type], trace.our_king_tropism[piece_type][color], distance_to_our_king);
         }
 
         if constexpr (piece_type == KING || piece_type == QUEEN || piece_type == ROOK) {
             if (!(MASK_FILE[file_of(square)] & evaluation_information.pawns[color])) {
                 if (!(MASK_FILE[file_of(square)] & evaluation_information.pawns[~color])) {
-                    score += OPEN_FILE_VALUES[piece_type];
-                    trace.open_file_values[piece_type][color]++;
+                    add_term<mode>(score, trace, OPEN_FILE_VALUES[piece_type], trace.open_file_values[piece_type][color]);
                 }
                 else {
-                    score += SEMI_OPEN_FILE_VALUES[piece_type];
-                    trace.semi_open_file_values[piece_type][color]++;
+                    add_term<mode>(score, trace, SEMI_OPEN_FILE_VALUES[piece_type], trace.semi_open_file_values[piece_type][color]);
                 }
             }
         }
@@ -489,51 +438,48 @@ SCORE_TYPE evaluate_piece(Position& position, Color color, EvaluationInformation
         if constexpr (piece_type == KING) {
             File file = file_of(square);
             if (file <= 2) {  // Queen side: Files A, B, C  (0, 1, 2)
-                score += evaluate_king_pawn(position, 0, color, evaluation_information, trace);
-                score += evaluate_king_pawn(position, 1, color, evaluation_information, trace);
-                score += evaluate_king_pawn(position, 2, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 0, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 1, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 2, color, evaluation_information, trace);
             }
 
             else if (file >= 5) {  // King side: Files F, G, H  (5, 6, 7)
-                score += evaluate_king_pawn(position, 5, color, evaluation_information, trace);
-                score += evaluate_king_pawn(position, 6, color, evaluation_information, trace);
-                score += evaluate_king_pawn(position, 7, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 5, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 6, color, evaluation_information, trace);
+                score += evaluate_king_pawn<mode>(position, 7, color, evaluation_information, trace);
             }
         }
 
         for (int opp_piece = 0; opp_piece < 6; opp_piece++) {
-            score += static_cast<SCORE_TYPE>(popcount(
-                    piece_attacks & position.get_pieces(static_cast<PieceType>(opp_piece), ~color))) *
-                    PIECE_THREATS[piece_type][opp_piece];
-
-            trace.piece_threats[piece_type][opp_piece][color] += popcount(
-                    piece_attacks & position.get_pieces(static_cast<PieceType>(opp_piece), ~color));
+            add_term<mode>(score, trace, PIECE_THREATS[piece_type][opp_piece], trace.piece_threats[piece_type][opp_piece][color],
+                           popcount(piece_attacks & position.get_pieces(static_cast<PieceType>(opp_piece), ~color)));
         }
     }
 
     return score;
 }
 
-SCORE_TYPE evaluate_pieces(Position& position, EvaluationInformation& evaluation_information, Trace& trace) {
-    SCORE_TYPE score = 0;
+template<EvalMode mode>
+mode_score_t<mode> evaluate_pieces(Position& position, EvaluationInformation& evaluation_information, Trace& trace) {
+    mode_score_t<mode> score{};
 
-    score += evaluate_pawns(position, WHITE, evaluation_information, trace);
-    score -= evaluate_pawns(position, BLACK, evaluation_information, trace);
+    score += evaluate_pawns<mode>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_pawns<mode>(position, BLACK, evaluation_information, trace);
 
-    score += evaluate_piece<KNIGHT>(position, WHITE, evaluation_information, trace);
-    score -= evaluate_piece<KNIGHT>(position, BLACK, evaluation_information, trace);
+    score += evaluate_piece<mode, KNIGHT>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_piece<mode, KNIGHT>(position, BLACK, evaluation_information, trace);
 
-    score += evaluate_piece<BISHOP>(position, WHITE, evaluation_information, trace);
-    score -= evaluate_piece<BISHOP>(position, BLACK, evaluation_information, trace);
+    score += evaluate_piece<mode, BISHOP>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_piece<mode, BISHOP>(position, BLACK, evaluation_information, trace);
 
-    score += evaluate_piece<ROOK>(position, WHITE, evaluation_information, trace);
-    score -= evaluate_piece<ROOK>(position, BLACK, evaluation_information, trace);
+    score += evaluate_piece<mode, ROOK>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_piece<mode, ROOK>(position, BLACK, evaluation_information, trace);
 
-    score += evaluate_piece<QUEEN>(position, WHITE, evaluation_information, trace);
-    score -= evaluate_piece<QUEEN>(position, BLACK, evaluation_information, trace);
+    score += evaluate_piece<mode, QUEEN>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_piece<mode, QUEEN>(position, BLACK, evaluation_information, trace);
 
-    score += evaluate_piece<KING>(position, WHITE, evaluation_information, trace);
-    score -= evaluate_piece<KING>(position, BLACK, evaluation_information, trace);
+    score += evaluate_piece<mode, KING>(position, WHITE, evaluation_information, trace);
+    score -= evaluate_piece<mode, KING>(position, BLACK, evaluation_information, trace);
 
     return score;
 }
@@ -745,38 +691,52 @@ double evaluate_opposite_colored_bishop_endgames(Position& position, EvaluationI
     return 1.0;
 }
 
-SCORE_TYPE evaluate(Position& position, Trace& trace) {
+template<EvalMode mode>
+mode_evaluation_t<mode> evaluate(Position& position, Trace& trace) {
 
     EvaluationInformation evaluation_information{};
     initialize_evaluation_information(position, evaluation_information);
 
-    SCORE_TYPE score = 0;
+    mode_score_t<mode> score{};
     int game_phase = 0;
 
-    score += evaluate_pieces(position, evaluation_information, trace);
+    score += evaluate_pieces<mode>(position, evaluation_information, trace);
 
     evaluation_information.total_king_ring_attacks[WHITE] = std::min<int>(evaluation_information.total_king_ring_attacks[WHITE], 39);
     evaluation_information.total_king_ring_attacks[BLACK] = std::min<int>(evaluation_information.total_king_ring_attacks[BLACK], 39);
 
-    score += TOTAL_KING_RING_ATTACKS[evaluation_information.total_king_ring_attacks[WHITE]];
-    score -= TOTAL_KING_RING_ATTACKS[evaluation_information.total_king_ring_attacks[BLACK]];
+    mode_score_t<mode> black_score{};
+    add_term<mode>(score, trace, TOTAL_KING_RING_ATTACKS[evaluation_information.total_king_ring_attacks[WHITE]],
+                   trace.total_king_ring_attacks[evaluation_information.total_king_ring_attacks[WHITE]][WHITE]);
+    add_term<mode>(black_score, trace, TOTAL_KING_RING_ATTACKS[evaluation_information.total_king_ring_attacks[BLACK]],
+                   trace.total_king_ring_attacks[evaluation_information.total_king_ring_attacks[BLACK]][BLACK]);
 
-    trace.total_king_ring_attacks[evaluation_information.total_king_ring_attacks[WHITE]][WHITE]++;
-    trace.total_king_ring_attacks[evaluation_information.total_king_ring_attacks[BLACK]][BLACK]++;
+    if (position.side == WHITE) add_term<mode>(score, trace, TEMPO_BONUS, trace.tempo_bonus[WHITE]);
+    else add_term<mode>(black_score, trace, TEMPO_BONUS, trace.tempo_bonus[BLACK]);
 
-    score += (position.side * -2 + 1) * TEMPO_BONUS;
-    trace.tempo_bonus[position.side]++;
+    // Only the trace is wanted, the scaling below would be done on a score of zero
+    if constexpr (mode == EvalMode::Trace) return 0;
 
-    game_phase = std::min(game_phase, 24);
+    score -= black_score;
 
-    SCORE_TYPE evaluation = (mg_score(score) * game_phase + eg_score(score) * (24 - game_phase)) / 24;
+    if constexpr (mode == EvalMode::Score) {
+        // Like the linear eval of the tuner: the phase is not capped and the endgame is not scaled
+        const tune_t phase = evaluation_information.game_phase;
+        const tune_t evaluation = (score.midgame * phase + score.endgame * (24 - phase)) / 24;
+        return (position.side * -2 + 1) * evaluation;
+    }
+    else {
+        game_phase = std::min(game_phase, 24);
+
+        SCORE_TYPE evaluation = (mg_score(score) * game_phase + eg_score(score) * (24 - game_phase)) / 24;
 
-    double drawishness = evaluate_drawishness(position, evaluation_information);
-    double opposite_colored_bishop_scale_factor = evaluate_opposite_colored_bishop_endgames(position, evaluation_information);
+        double drawishness = evaluate_drawishness(position, evaluation_information);
+        double opposite_colored_bishop_scale_factor = evaluate_opposite_colored_bishop_endgames(position, evaluation_information);
 
-    evaluation = static_cast<SCORE_TYPE>(evaluation * drawishness * opposite_colored_bishop_scale_factor);
+        evaluation = static_cast<SCORE_TYPE>(evaluation * drawishness * opposite_colored_bishop_scale_factor);
 
-    return (position.side * -2 + 1) * evaluation;
+        return (position.side * -2 + 1) * evaluation;
+    }
 }
 
 
@@ -926,50 +886,57 @@ static void rebalance_mobility_arrays(parameters_t& parameters, const int materi
 }
 
 
-static coefficients_t get_coefficients(const Trace& trace)
+static size_t get_parameter_count()
 {
-    coefficients_t coefficients;
-    get_coefficient_array(coefficients, trace.piece_values, 6);
-    get_coefficient_array_2d(coefficients, trace.piece_square_tables, 6, 64);
-
-    get_coefficient_array_2d(coefficients, trace.mobility_values, 4, 28);
-
-    get_coefficient_array_2d(coefficients, trace.passed_pawn_bonuses, 3, 8);
-    get_coefficient_array_2d(coefficients, trace.passed_pawn_blockers, 6, 8);
-    get_coefficient_array_2d(coefficients, trace.passed_pawn_blockers_2, 6, 8);
-
-    get_coefficient_array(coefficients, trace.phalanx_pawn_bonuses, 8);
-
-    get_coefficient_single(coefficients, trace.isolated_pawn_penalty);
-
-    get_coefficient_single(coefficients, trace.bishop_pair_bonus);
-
-    get_coefficient_single(coefficients, trace.tempo_bonus);
-
-    get_coefficient_array(coefficients, trace.semi_open_file_values, 6);
-    get_coefficient_array(coefficients, trace.open_file_values, 6);
-
-    get_coefficient_array_2d(coefficients, trace.piece_threats, 6, 6);
-
-    get_coefficient_array_2d(coefficients, trace.king_ring_attacks, 2, 6);
-    get_coefficient_array(coefficients, trace.total_king_ring_attacks, 40);
-
-    get_coefficient_array_2d(coefficients, trace.king_pawn_shield, 5, 8);
-    get_coefficient_array_2d(coefficients, trace.king_pawn_storm, 6, 8);
+    static const size_t parameter_count = AltairEval::get_initial_parameters().size();
+    return parameter_count;
+}
 
-    get_coefficient_array(coefficients, trace.opp_king_tropism, 6);
-    get_coefficient_array(coefficients, trace.our_king_tropism, 6);
+// Traces position into sink and returns its score, the caller collects the coefficients
+static SCORE_TYPE evaluate_trace(Position& position, TraceSink& sink)
+{
+    Trace trace(sink);
+    constexpr auto mode = AltairEval::includes_additional_score ? EvalMode::Both : EvalMode::Trace;
+    trace.score = evaluate<mode>(position, trace);
+    return trace.score;
+}
 
-    get_coefficient_single(coefficients, trace.doubled_pawn_penalty);
+// Reused between positions so only the first evaluations of a thread allocate
+static TraceSink& get_thread_sink()
+{
+    thread_local TraceSink sink(get_parameter_count());
+    return sink;
+}
 
-    get_coefficient_single(coefficients, trace.square_of_the_pawn);
+static void evaluate_sparse(Position& position, SparseEvalResult& result)
+{
+    auto& sink = get_thread_sink();
+    result.score = evaluate_trace(position, sink);
+    sink.get_coefficients(result.coefficients);
+    result.endgame_scale = 1;
+}
 
-    get_coefficient_array(coefficients, trace.backwards_pawn_penalty, 2);
+static tune_t evaluate_score(Position& position, const parameters_t& parameters)
+{
+    // Score mode never touches the sink, the trace only needs one to exist
+    static TraceSink unused_sink(0);
 
-    get_coefficient_array(coefficients, trace.passed_our_distance, 8);
-    get_coefficient_array(coefficients, trace.passed_opp_distance, 8);
+    Trace trace(unused_sink, parameters.data());
+    const tune_t score = evaluate<EvalMode::Score>(position, trace);
+    return position.side == WHITE ? score : -score;
+}
 
-    return coefficients;
+static EvalResult get_dense_eval_result(const SparseEvalResult& sparse_result)
+{
+    EvalResult result;
+    result.coefficients.assign(get_parameter_count(), 0);
+    for (const auto& coefficient : sparse_result.coefficients)
+    {
+        result.coefficients[coefficient.index] = coefficient.value;
+    }
+    result.score = sparse_result.score;
+    result.endgame_scale = sparse_result.endgame_scale;
+    return result;
 }
 
 
@@ -1019,10 +986,15 @@ parameters_t AltairEval::get_initial_parameters() {
 }
 
 
+void AltairEval::rebalance_parameters(parameters_t& parameters) {
+    rebalance_piece_square_tables(parameters, 0, 6);
+    rebalance_mobility_arrays(parameters, 0, 6 + 6 * 64);
+}
+
+
 void AltairEval::print_parameters(const parameters_t &parameters) {
     parameters_t parameters_copy = parameters;
-    rebalance_piece_square_tables(parameters_copy, 0, 6);
-    rebalance_mobility_arrays(parameters_copy, 0, 6 + 6 * 64);
+    rebalance_parameters(parameters_copy);
 
     int index = 0;
     stringstream ss;
@@ -1126,31 +1098,56 @@ Position get_position_from_external(const Chess::Board& board)
     return position;
 }
 
-EvalResult AltairEval::get_fen_eval_result(const string &fen) {
+void AltairEval::get_fen_sparse_eval_result(const string& fen, SparseEvalResult& result) {
     Position position;
     position.set_fen(fen);
+    evaluate_sparse(position, result);
+}
 
-    Trace trace{};
-    trace.score = evaluate(position, trace);
-
-    EvalResult result;
-    result.coefficients = get_coefficients(trace);
-    result.score = trace.score;
+void AltairEval::get_parsed_sparse_eval_result(const ParsedFen& fen, SparseEvalResult& result) {
+    Position position;
+    position.set_board(fen);
+    evaluate_sparse(position, result);
+}
 
-    return result;
+void AltairEval::get_parsed_sparse_eval_results(std::span<const ParsedFen> fens, SparseEvalBatch& results) {
+    // One position and sink for the whole batch, the rows go straight into the buffer of the caller
+    auto& sink = get_thread_sink();
+    Position position;
+    results.clear();
+    for (const auto& fen : fens) {
+        position.set_board(fen);
+        const SCORE_TYPE score = evaluate_trace(position, sink);
+        sink.append_coefficients(results.coefficients);
+        results.end_row(score, 1);
+    }
 }
 
-EvalResult AltairEval::get_external_eval_result(const Chess::Board& board)
-{
+void AltairEval::get_external_sparse_eval_result(const Chess::Board& board, SparseEvalResult& result) {
     auto position = get_position_from_external(board);
+    evaluate_sparse(position, result);
+}
 
-    Trace trace{};
-    trace.score = evaluate(position, trace);
+tune_t AltairEval::get_fen_score(const string& fen, const parameters_t& parameters) {
+    Position position;
+    position.set_fen(fen);
+    return evaluate_score(position, parameters);
+}
 
-    EvalResult result;
-    result.coefficients = get_coefficients(trace);
-    result.score = trace.score;
-    result.endgame_scale = 1;
+tune_t AltairEval::get_external_score(const Chess::Board& board, const parameters_t& parameters) {
+    auto position = get_position_from_external(board);
+    return evaluate_score(position, parameters);
+}
 
-    return result;
-}
\ No newline at end of file
+EvalResult AltairEval::get_fen_eval_result(const string &fen) {
+    SparseEvalResult result;
+    get_fen_sparse_eval_result(fen, result);
+    return get_dense_eval_result(result);
+}
+
+EvalResult AltairEval::get_external_eval_result(const Chess::Board& board)
+{
+    SparseEvalResult result;
+    get_external_sparse_eval_result(board, result);
+    return get_dense_eval_result(result);
+}
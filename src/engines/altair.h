@@ -6,6 +6,8 @@
 #define TUNER_ALTAIR_H
 
 #include "../base.h"
+#include "../fen.h"
+#include <span>
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -61,6 +63,7 @@ public:
     void remove_piece(Piece piece, Square square);
     void place_piece(Piece piece, Square square);
 
+    void set_board(const ParsedFen& fen);
     PLY_TYPE set_fen(const std::string& fen);
 
 };
@@ -68,48 +71,64 @@ public:
 constexpr char PIECE_MATCHER[12] = {'P', 'N', 'B', 'R', 'Q', 'K', 'p', 'n', 'b', 'r', 'q', 'k'};
 constexpr int GAME_PHASE_SCORES[6] = {0, 1, 1, 2, 4, 0};
 
+// What an evaluation computes. Trace only fills the trace, Score only sums the unrounded tuned values of
+// Trace::parameters in place of the engine constants and tapers them like the linear eval of the tuner, Both fills
+// the trace and sums the engine constants
+enum class EvalMode {
+    Trace,
+    Score,
+    Both
+};
+
+// Each array counts the uses of a parameter for each side, in the order of get_initial_parameters
 struct Trace {
+    explicit Trace(TraceSink& sink, const pair_t* parameters = nullptr) : sink(sink), parameters(parameters) {}
+
+    TraceSink& sink;
+    // Tuned values of the parameters, indexed like the sink, read by score mode
+    const pair_t* parameters;
+
     int score={};
 
-    short piece_values[6][2]{};
-    short piece_square_tables[6][64][2]{};
+    TraceArray<6> piece_values{sink, 0};
+    TraceArray<6, 64> piece_square_tables{sink, piece_values.end()};
 
-    short mobility_values[4][28][2]{};
+    TraceArray<4, 28> mobility_values{sink, piece_square_tables.end()};
 
-    short passed_pawn_bonuses[3][8][2]{};
-    short passed_pawn_blockers[6][8][2]{};
-    short passed_pawn_blockers_2[6][8][2]{};
+    TraceArray<3, 8> passed_pawn_bonuses{sink, mobility_values.end()};
+    TraceArray<6, 8> passed_pawn_blockers{sink, passed_pawn_bonuses.end()};
+    TraceArray<6, 8> passed_pawn_blockers_2{sink, passed_pawn_blockers.end()};
 
-    short phalanx_pawn_bonuses[8][2]{};
+    TraceArray<8> phalanx_pawn_bonuses{sink, passed_pawn_blockers_2.end()};
 
-    short isolated_pawn_penalty[2]{};
+    TraceArray<> isolated_pawn_penalty{sink, phalanx_pawn_bonuses.end()};
 
-    short bishop_pair_bonus[2]{};
+    TraceArray<> bishop_pair_bonus{sink, isolated_pawn_penalty.end()};
 
-    short tempo_bonus[2]{};
+    TraceArray<> tempo_bonus{sink, bishop_pair_bonus.end()};
 
-    short semi_open_file_values[6][2]{};
-    short open_file_values[6][2]{};
+    TraceArray<6> semi_open_file_values{sink, tempo_bonus.end()};
+    TraceArray<6> open_file_values{sink, semi_open_file_values.end()};
 
-    short piece_threats[6][6][2]{};
+    TraceArray<6, 6> piece_threats{sink, open_file_values.end()};
 
-    short king_ring_attacks[2][6][2]{};
-    short total_king_ring_attacks[50][2]{};
+    TraceArray<2, 6> king_ring_attacks{sink, piece_threats.end()};
+    TraceArray<40> total_king_ring_attacks{sink, king_ring_attacks.end()};
 
-    short king_pawn_shield[5][8][2]{};
-    short king_pawn_storm[6][8][2]{};
+    TraceArray<5, 8> king_pawn_shield{sink, total_king_ring_attacks.end()};
+    TraceArray<6, 8> king_pawn_storm{sink, king_pawn_shield.end()};
 
-    short opp_king_tropism[6][2]{};
-    short our_king_tropism[6][2]{};
+    TraceArray<6> opp_king_tropism{sink, king_pawn_storm.end()};
+    TraceArray<6> our_king_tropism{sink, opp_king_tropism.end()};
 
-    short doubled_pawn_penalty[2]{};
+    TraceArray<> doubled_pawn_penalty{sink, our_king_tropism.end()};
 
-    short square_of_the_pawn[2]{};
+    TraceArray<> square_of_the_pawn{sink, doubled_pawn_penalty.end()};
 
-    short backwards_pawn_penalty[2][2]{};
+    TraceArray<2> backwards_pawn_penalty{sink, square_of_the_pawn.end()};
 
-    short passed_our_distance[8][2]{};
-    short passed_opp_distance[8][2]{};
+    TraceArray<8> passed_our_distance{sink, backwards_pawn_penalty.end()};
+    TraceArray<8> passed_opp_distance{sink, passed_our_distance.end()};
 };
 
 template<int n>
@@ -144,10 +163,22 @@ namespace Altair {
     public:
         constexpr static bool includes_additional_score = true;
         constexpr static bool supports_external_chess_eval = true;
+        // Bumped whenever the terms an evaluation traces change, the data cache is keyed on it
+        constexpr static int32_t trace_version = 1;
 
         static parameters_t get_initial_parameters();
         static EvalResult get_fen_eval_result(const std::string& fen);
         static EvalResult get_external_eval_result(const Chess::Board& board);
+        static void get_fen_sparse_eval_result(const std::string& fen, SparseEvalResult& result);
+        static void get_parsed_sparse_eval_result(const ParsedFen& fen, SparseEvalResult& result);
+        static void get_parsed_sparse_eval_results(std::span<const ParsedFen> fens, SparseEvalBatch& results);
+        static void get_external_sparse_eval_result(const Chess::Board& board, SparseEvalResult& result);
+        // Score mode evaluations of parameters from white's point of view, the same value as the dot product of the
+        // coefficients with the parameters tapered by the phase, without tracing the position
+        static tune_t get_fen_score(const std::string& fen, const parameters_t& parameters);
+        static tune_t get_external_score(const Chess::Board& board, const parameters_t& parameters);
+        // Moves the averages of the piece square tables and mobility arrays into the piece values, as printed
+        static void rebalance_parameters(parameters_t& parameters);
         static void print_parameters(const parameters_t& parameters);
     };
 }
@@ -0,0 +1,387 @@
+#include "entry_file.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+constexpr char entry_file_magic[8] = {'T', 'X', 'L', 'C', 'A', 'C', 'H', 'E'};
+
+struct EntryFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tune_size;
+    uint64_t key;
+    uint64_t entry_count;
+    uint64_t coefficient_size;
+    uint64_t chunk_count;
+};
+
+struct ChunkHeader
+{
+    uint32_t entry_count;
+    uint32_t coefficient_size;
+};
+
+struct StoredEntry
+{
+    EntryHeader header;
+    uint32_t coefficient_size;
+    uint8_t padding[4];
+};
+
+constexpr size_t chunk_alignment = alignof(StoredEntry);
+
+static_assert(sizeof(EntryFileHeader) % chunk_alignment == 0);
+static_assert(sizeof(ChunkHeader) % chunk_alignment == 0);
+
+static size_t get_chunk_padding(const uint32_t coefficient_size)
+{
+    return (chunk_alignment - coefficient_size % chunk_alignment) % chunk_alignment;
+}
+
+static StoredEntry get_stored_entry(const EntrySet& entries, const size_t entry_index)
+{
+    StoredEntry stored_entry{};
+    stored_entry.header = entries.headers[entry_index];
+    stored_entry.coefficient_size = static_cast<uint32_t>(entries.offsets[entry_index + 1] - entries.offsets[entry_index]);
+    return stored_entry;
+}
+
+// Appends the fixed size part of a chunk, its coefficients must already be at the end of entries.coefficients
+static void append_stored_entries(EntrySet& entries, const StoredEntry* stored_entries, const uint32_t entry_count)
+{
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        const auto& stored_entry = stored_entries[i];
+        entries.offsets.push_back(entries.offsets.back() + stored_entry.coefficient_size);
+        entries.headers.push_back(stored_entry.header);
+    }
+
+    if (entries.offsets.back() != entries.coefficients.size())
+    {
+        throw runtime_error("Entry file coefficient count mismatch");
+    }
+}
+
+static bool is_valid_header(const EntryFileHeader& header, const uint64_t key)
+{
+    return memcmp(header.magic, entry_file_magic, sizeof(entry_file_magic)) == 0
+           && header.version == entry_file_version
+           && header.tune_size == sizeof(tune_t)
+           && header.key == key;
+}
+
+bool EntryFileWriter::open(const string& file_path, const uint64_t file_key)
+{
+    path = file_path;
+    key = file_key;
+    written_entry_count = 0;
+    written_coefficient_size = 0;
+    written_chunk_count = 0;
+
+    // Written under a temporary name and renamed, so an interrupted run never leaves a valid looking file
+    temporary_path = path + ".tmp";
+    file.open(temporary_path, ios::binary | ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    const EntryFileHeader placeholder{};
+    file.write(reinterpret_cast<const char*>(&placeholder), sizeof(placeholder));
+    return static_cast<bool>(file);
+}
+
+void EntryFileWriter::write(const EntrySet& entries)
+{
+    for (size_t chunk_start = 0; chunk_start < entries.size(); chunk_start += entry_file_chunk_size)
+    {
+        const auto count = static_cast<uint32_t>(min<size_t>(entry_file_chunk_size, entries.size() - chunk_start));
+        write_chunk(entries, chunk_start, count);
+    }
+}
+
+void EntryFileWriter::write_chunk(const EntrySet& entries, const size_t first_entry, const uint32_t count)
+{
+    const auto coefficients_begin = entries.offsets[first_entry];
+    const auto coefficients_end = entries.offsets[first_entry + count];
+    const ChunkHeader chunk_header{count, static_cast<uint32_t>(coefficients_end - coefficients_begin)};
+    file.write(reinterpret_cast<const char*>(&chunk_header), sizeof(chunk_header));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const auto stored_entry = get_stored_entry(entries, first_entry + i);
+        file.write(reinterpret_cast<const char*>(&stored_entry), sizeof(stored_entry));
+    }
+
+    file.write(reinterpret_cast<const char*>(entries.coefficients.data() + coefficients_begin), static_cast<streamsize>(chunk_header.coefficient_size));
+
+    constexpr char padding[chunk_alignment] = {};
+    file.write(padding, static_cast<streamsize>(get_chunk_padding(chunk_header.coefficient_size)));
+
+    written_entry_count += count;
+    written_coefficient_size += chunk_header.coefficient_size;
+    written_chunk_count++;
+}
+
+bool EntryFileWriter::close()
+{
+    EntryFileHeader header{};
+    memcpy(header.magic, entry_file_magic, sizeof(entry_file_magic));
+    header.version = entry_file_version;
+    header.tune_size = sizeof(tune_t);
+    header.key = key;
+    header.entry_count = written_entry_count;
+    header.coefficient_size = written_coefficient_size;
+    header.chunk_count = written_chunk_count;
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+    if (!file)
+    {
+        cout << "Failed to write entry file " << temporary_path << endl;
+        return false;
+    }
+
+    error_code error;
+    filesystem::rename(temporary_path, path, error);
+    if (error)
+    {
+        cout << "Failed to store entry file " << path << ": " << error.message() << endl;
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t EntryFileWriter::entry_count() const
+{
+    return written_entry_count;
+}
+
+bool read_entry_file(const string& path, const uint64_t key, EntrySet& entries)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(EntryFileHeader))
+    {
+        return false;
+    }
+    file.advise_sequential();
+
+    EntryFileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (!is_valid_header(header, key))
+    {
+        cout << "Entry file " << path << " is stale, ignoring it" << endl;
+        return false;
+    }
+
+    entries.reserve(entries.size() + header.entry_count, entries.coefficients.size() + header.coefficient_size);
+    size_t offset = sizeof(header);
+    for (uint64_t chunk_index = 0; chunk_index < header.chunk_count; chunk_index++)
+    {
+        if (offset + sizeof(ChunkHeader) > file.size())
+        {
+            throw runtime_error("Entry file is truncated");
+        }
+
+        ChunkHeader chunk_header;
+        memcpy(&chunk_header, file.data() + offset, sizeof(chunk_header));
+        offset += sizeof(chunk_header);
+
+        const auto chunk_size = chunk_header.entry_count * sizeof(StoredEntry)
+                                + chunk_header.coefficient_size
+                                + get_chunk_padding(chunk_header.coefficient_size);
+        if (offset + chunk_size > file.size())
+        {
+            throw runtime_error("Entry file is truncated");
+        }
+
+        const auto stored_entries = reinterpret_cast<const StoredEntry*>(file.data() + offset);
+        const auto coefficients = reinterpret_cast<const uint8_t*>(stored_entries + chunk_header.entry_count);
+        entries.coefficients.insert(entries.coefficients.end(), coefficients, coefficients + chunk_header.coefficient_size);
+        append_stored_entries(entries, stored_entries, chunk_header.entry_count);
+
+        offset += chunk_size;
+    }
+
+    return true;
+}
+
+bool EntryStream::open(const string& file_path, const uint64_t key, const uint64_t memory_budget)
+{
+    ifstream file(file_path, ios::binary);
+    EntryFileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || !is_valid_header(header, key))
+    {
+        return false;
+    }
+
+    path = file_path;
+    entry_count = header.entry_count;
+    total_chunk_count = header.chunk_count;
+
+    // A chunk in memory costs about as much as it does on disk
+    const auto average_coefficient_size = entry_count > 0 ? header.coefficient_size / entry_count + 1 : 0;
+    const auto chunk_memory = entry_file_chunk_size * (sizeof(StoredEntry) + average_coefficient_size);
+    const auto chunk_budget = max<uint64_t>(memory_budget / chunk_memory, 2);
+    buffers.resize(static_cast<size_t>(min<uint64_t>(chunk_budget, max<uint64_t>(total_chunk_count, 1))));
+
+    return true;
+}
+
+uint64_t EntryStream::size() const
+{
+    return entry_count;
+}
+
+uint64_t EntryStream::chunk_count() const
+{
+    return total_chunk_count;
+}
+
+uint32_t EntryStream::read_ahead() const
+{
+    return static_cast<uint32_t>(buffers.size());
+}
+
+void EntryStream::for_each_chunk(const function<void(const EntrySet&)>& chunk_handler)
+{
+    mutex queue_mutex;
+    condition_variable queue_condition;
+    queue<size_t> free_buffers;
+    queue<size_t> full_buffers;
+    bool reader_done = false;
+    bool should_stop = false;
+    exception_ptr reader_error;
+
+    for (size_t buffer_index = 0; buffer_index < buffers.size(); buffer_index++)
+    {
+        free_buffers.push(buffer_index);
+    }
+
+    thread reader([&]()
+    {
+        try
+        {
+            ifstream file(path, ios::binary);
+            file.seekg(sizeof(EntryFileHeader));
+
+            vector<StoredEntry> stored_entries;
+            for (uint64_t chunk_index = 0; chunk_index < total_chunk_count; chunk_index++)
+            {
+                size_t buffer_index;
+                {
+                    unique_lock<mutex> lock(queue_mutex);
+                    queue_condition.wait(lock, [&]
+                    {
+                        return !free_buffers.empty() || should_stop;
+                    });
+                    if (should_stop)
+                    {
+                        break;
+                    }
+                    buffer_index = free_buffers.front();
+                    free_buffers.pop();
+                }
+
+                // Recycled buffers keep their capacity, so after the first pass chunks are read without allocating
+                auto& chunk = buffers[buffer_index];
+                chunk.clear();
+
+                ChunkHeader chunk_header;
+                file.read(reinterpret_cast<char*>(&chunk_header), sizeof(chunk_header));
+                stored_entries.resize(chunk_header.entry_count);
+                file.read(reinterpret_cast<char*>(stored_entries.data()), static_cast<streamsize>(stored_entries.size() * sizeof(StoredEntry)));
+
+                chunk.coefficients.resize(chunk_header.coefficient_size);
+                file.read(reinterpret_cast<char*>(chunk.coefficients.data()), static_cast<streamsize>(chunk.coefficients.size()));
+                file.ignore(static_cast<streamsize>(get_chunk_padding(chunk_header.coefficient_size)));
+                if (!file)
+                {
+                    throw runtime_error("Entry file is truncated");
+                }
+
+                append_stored_entries(chunk, stored_entries.data(), chunk_header.entry_count);
+
+                {
+                    unique_lock<mutex> lock(queue_mutex);
+                    full_buffers.push(buffer_index);
+                }
+                queue_condition.notify_all();
+            }
+        }
+        catch (...)
+        {
+            reader_error = current_exception();
+        }
+
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            reader_done = true;
+        }
+        queue_condition.notify_all();
+    });
+
+    exception_ptr handler_error;
+    while (true)
+    {
+        size_t buffer_index;
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            queue_condition.wait(lock, [&]
+            {
+                return !full_buffers.empty() || reader_done;
+            });
+            if (full_buffers.empty())
+            {
+                break;
+            }
+            buffer_index = full_buffers.front();
+            full_buffers.pop();
+        }
+
+        try
+        {
+            chunk_handler(buffers[buffer_index]);
+        }
+        catch (...)
+        {
+            handler_error = current_exception();
+            {
+                unique_lock<mutex> lock(queue_mutex);
+                should_stop = true;
+            }
+            queue_condition.notify_all();
+            break;
+        }
+
+        {
+            unique_lock<mutex> lock(queue_mutex);
+            free_buffers.push(buffer_index);
+        }
+        queue_condition.notify_all();
+    }
+
+    reader.join();
+
+    if (handler_error)
+    {
+        rethrow_exception(handler_error);
+    }
+    if (reader_error)
+    {
+        rethrow_exception(reader_error);
+    }
+}
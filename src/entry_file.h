@@ -0,0 +1,60 @@
+#ifndef ENTRY_FILE_H
+#define ENTRY_FILE_H 1
+
+#include "base.h"
+#include "dataset.h"
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Entry files store loaded entries for the data cache and the streaming mode. A header is followed by
+// chunks of up to entry_file_chunk_size entries, each holding the fixed size part of its entries
+// followed by their coefficients, so a chunk can be read back with two sequential reads
+constexpr uint32_t entry_file_version = 4;
+constexpr uint32_t entry_file_chunk_size = 1 << 16;
+
+class EntryFileWriter {
+public:
+    bool open(const std::string& path, uint64_t key);
+    void write(const EntrySet& entries);
+    bool close();
+
+    uint64_t entry_count() const;
+
+private:
+    std::string path;
+    std::string temporary_path;
+    std::ofstream file;
+    uint64_t key = 0;
+    uint64_t written_entry_count = 0;
+    uint64_t written_coefficient_size = 0;
+    uint64_t written_chunk_count = 0;
+
+    void write_chunk(const EntrySet& entries, size_t first_entry, uint32_t count);
+};
+
+bool read_entry_file(const std::string& path, uint64_t key, EntrySet& entries);
+
+// Reads an entry file chunk by chunk on a background thread, keeping as many chunks ahead of
+// the consumer as the memory budget allows
+class EntryStream {
+public:
+    bool open(const std::string& path, uint64_t key, uint64_t memory_budget);
+
+    uint64_t size() const;
+    uint64_t chunk_count() const;
+    uint32_t read_ahead() const;
+
+    void for_each_chunk(const std::function<void(const EntrySet&)>& chunk_handler);
+
+private:
+    std::string path;
+    uint64_t entry_count = 0;
+    uint64_t total_chunk_count = 0;
+    std::vector<EntrySet> buffers;
+};
+
+#endif // !ENTRY_FILE_H
@@ -0,0 +1,247 @@
+#include "fen.h"
+
+#include <bit>
+#include <charconv>
+
+using namespace std;
+
+struct WdlMarker
+{
+    string_view marker;
+    tune_t wdl;
+};
+
+static constexpr array<WdlMarker, 6> markers
+{
+    WdlMarker{"1.0", 1},
+    WdlMarker{"0.5", 0.5},
+    WdlMarker{"0.0", 0},
+
+    WdlMarker{"1-0", 1},
+    WdlMarker{"1/2-1/2", 0.5},
+    WdlMarker{"0-1", 0}
+};
+
+static constexpr auto piece_letters = []
+{
+    array<uint8_t, 256> letters{};
+    letters.fill(fen_empty_square);
+    constexpr string_view piece_order = "PNBRQKpnbrqk";
+    for (size_t piece = 0; piece < piece_order.size(); piece++)
+    {
+        letters[static_cast<uint8_t>(piece_order[piece])] = static_cast<uint8_t>(piece);
+    }
+    return letters;
+}();
+
+static constexpr array<int32_t, fen_piece_count> piece_phases = {0, 1, 1, 2, 4, 0, 0, 1, 1, 2, 4, 0};
+
+static bool is_space(const char ch)
+{
+    return ch == ' ' || ch == '\t';
+}
+
+// Returns the next space separated field of line at or after position and moves position past it
+static string_view next_field(const string_view line, size_t& position)
+{
+    while (position < line.size() && is_space(line[position]))
+    {
+        position++;
+    }
+
+    const auto start = position;
+    while (position < line.size() && !is_space(line[position]))
+    {
+        position++;
+    }
+    return line.substr(start, position - start);
+}
+
+static bool is_number(const string_view field)
+{
+    if (field.empty())
+    {
+        return false;
+    }
+
+    for (const char ch : field)
+    {
+        if (ch < '0' || ch > '9')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_castling(const string_view field)
+{
+    if (field.empty())
+    {
+        return false;
+    }
+
+    for (const char ch : field)
+    {
+        if (ch != 'K' && ch != 'Q' && ch != 'k' && ch != 'q' && ch != '-')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_en_passant(const string_view field)
+{
+    return field == "-" || (field.size() == 2 && field[0] >= 'a' && field[0] <= 'h' && field[1] >= '1' && field[1] <= '8');
+}
+
+static bool parse_board(const string_view board, ParsedFen& fen)
+{
+    // The byte stores to fen.board may alias anything, so the other results are kept in locals until the end
+    array<uint64_t, fen_piece_count> pieces{};
+    int32_t phase = 0;
+    int32_t rank = 7;
+    int32_t file = 0;
+    for (const char ch : board)
+    {
+        if (ch == '/')
+        {
+            if (file != 8 || rank == 0)
+            {
+                return false;
+            }
+            rank--;
+            file = 0;
+        }
+        else if (ch >= '1' && ch <= '8')
+        {
+            file += ch - '0';
+            if (file > 8)
+            {
+                return false;
+            }
+        }
+        else
+        {
+            const auto piece = piece_letters[static_cast<uint8_t>(ch)];
+            if (piece == fen_empty_square || file >= 8)
+            {
+                return false;
+            }
+
+            const auto square = rank * 8 + file;
+            fen.board[square] = piece;
+            pieces[piece] |= 1ULL << square;
+            phase += piece_phases[piece];
+            file++;
+        }
+    }
+
+    fen.pieces = pieces;
+    fen.phase = phase;
+    return rank == 0 && file == 8;
+}
+
+// Looks for the result markers in what follows the FEN in one pass, or failing that for a "0.x" wdl word
+static void parse_result(const string_view rest, ParsedFen& fen)
+{
+    uint32_t found_markers = 0;
+    for (size_t position = 0; position < rest.size(); position++)
+    {
+        // Every marker starts with a 0 or a 1
+        if (rest[position] != '0' && rest[position] != '1')
+        {
+            continue;
+        }
+
+        const auto candidate = rest.substr(position);
+        for (uint32_t marker = 0; marker < markers.size(); marker++)
+        {
+            if (candidate.starts_with(markers[marker].marker))
+            {
+                found_markers |= 1u << marker;
+            }
+        }
+    }
+
+    fen.result_marker_count = popcount(found_markers);
+    fen.result = 0;
+    if (found_markers != 0)
+    {
+        // Like a search for each marker in turn, the last marker of the list that was found counts
+        fen.result = markers[bit_width(found_markers) - 1].wdl;
+        return;
+    }
+
+    size_t position = 0;
+    while (position < rest.size())
+    {
+        const auto word = next_field(rest, position);
+        if (word.starts_with("0."))
+        {
+            from_chars(word.data(), word.data() + word.size(), fen.result);
+            fen.result_marker_count = 1;
+        }
+    }
+}
+
+bool parse_fen(const string_view line, ParsedFen& fen)
+{
+    fen.board.fill(fen_empty_square);
+    fen.castling = 0;
+    fen.en_passant_square = fen_no_square;
+    fen.half_move_clock = 0;
+
+    size_t position = 0;
+    if (!parse_board(next_field(line, position), fen))
+    {
+        return false;
+    }
+
+    const auto side = next_field(line, position);
+    if (side != "w" && side != "b")
+    {
+        return false;
+    }
+    fen.white_to_move = side == "w";
+
+    // The remaining fields are optional, the first one that does not fit its slot starts the rest of the line
+    auto fen_end = position;
+    auto field = next_field(line, position);
+    if (is_castling(field))
+    {
+        for (const char ch : field)
+        {
+            fen.castling |= ch == 'K' ? 1 : ch == 'Q' ? 2 : ch == 'k' ? 4 : ch == 'q' ? 8 : 0;
+        }
+
+        fen_end = position;
+        field = next_field(line, position);
+        if (is_en_passant(field))
+        {
+            if (field.size() == 2)
+            {
+                fen.en_passant_square = static_cast<uint8_t>((field[1] - '1') * 8 + field[0] - 'a');
+            }
+
+            fen_end = position;
+            field = next_field(line, position);
+            if (is_number(field))
+            {
+                from_chars(field.data(), field.data() + field.size(), fen.half_move_clock);
+
+                fen_end = position;
+                field = next_field(line, position);
+                if (is_number(field))
+                {
+                    fen_end = position;
+                }
+            }
+        }
+    }
+
+    fen.fen = line.substr(0, fen_end);
+    parse_result(line.substr(fen_end), fen);
+    return true;
+}
@@ -0,0 +1,40 @@
+#ifndef FEN_H
+#define FEN_H 1
+
+#include "base.h"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+// Pieces of a parsed board are numbered in the FEN letter order PNBRQKpnbrqk, white first
+constexpr int32_t fen_piece_count = 12;
+constexpr uint8_t fen_empty_square = 12;
+constexpr uint8_t fen_no_square = 64;
+
+// A data line parsed in one pass without allocating: the FEN at its start and the result marker after it
+struct ParsedFen
+{
+    // Piece on every square from a1 = 0 to h8 = 63, or fen_empty_square
+    std::array<uint8_t, 64> board;
+    std::array<uint64_t, fen_piece_count> pieces;
+    bool white_to_move;
+    // K = 1, Q = 2, k = 4, q = 8
+    uint8_t castling;
+    uint8_t en_passant_square;
+    int32_t half_move_clock;
+    // 1 for every knight and bishop, 2 for every rook and 4 for every queen
+    int32_t phase;
+
+    // The FEN part of the line, up to its last field. Empty once the qsearch has moved the board away from it
+    std::string_view fen;
+    // Number of distinct result markers after the FEN, result is the wdl of the last one if there are any
+    int32_t result_marker_count;
+    tune_t result;
+};
+
+// Parses line into fen. Returns false if the board or the side to move is malformed, a missing result marker is
+// left to the caller to judge
+bool parse_fen(std::string_view line, ParsedFen& fen);
+
+#endif // !FEN_H
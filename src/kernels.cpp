@@ -0,0 +1,599 @@
+#include "kernels.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#if TAPERED && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_KERNELS 1
+#include <immintrin.h>
+#else
+#define SIMD_KERNELS 0
+#endif
+
+using namespace std;
+
+template<typename Real>
+static void add_entry_gradient(kernel_parameters_t<Real>& gradient, const EntrySet& entries, const size_t entry_index, const Real res)
+{
+#if TAPERED
+    const auto& header = entries.headers[entry_index];
+    const auto mg_base = res * static_cast<Real>(header.midgame_weight);
+    const auto eg_base = res * static_cast<Real>(header.endgame_weight);
+#endif
+
+    const auto coefficients_begin = entries.coefficients.data() + entries.offsets[entry_index];
+    const auto coefficients_end = entries.coefficients.data() + entries.offsets[entry_index + 1];
+    decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t index)
+    {
+#if TAPERED
+        gradient[index][static_cast<int32_t>(PhaseStages::Midgame)] += mg_base * static_cast<Real>(value);
+        gradient[index][static_cast<int32_t>(PhaseStages::Endgame)] += eg_base * static_cast<Real>(value);
+#else
+        gradient[index] += res * static_cast<Real>(value);
+#endif
+    });
+}
+
+// Reference implementation, the vectorized kernels compute the same sums up to rounding
+template<typename Real>
+static void scalar_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<Real>& parameters,
+                                const Real K, kernel_parameters_t<Real>* gradient, RangeOutput<Real>& output)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const auto eval = linear_eval(entries, i, parameters);
+        const auto sig = sigmoid(K, eval);
+        const auto diff = static_cast<Real>(entries.headers[i].get_wdl()) - sig;
+        const auto res = diff * sig * (1 - sig);
+        output.error.add(diff * diff);
+        if (output.residuals != nullptr)
+        {
+            output.residuals[i - begin] = res;
+        }
+        if (gradient != nullptr)
+        {
+            add_entry_gradient(*gradient, entries, i, res);
+        }
+    }
+}
+
+#if SIMD_KERNELS
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx2,fma")))
+
+// The generic SIMD code below is only ever inlined into the target specific entry points, so the vector
+// arguments of its helpers never cross a function boundary compiled without AVX. flatten alone does not
+// inline without optimization, which is why the generic functions are always_inline
+#define SIMD_INLINE inline __attribute__((always_inline))
+
+// Each SIMD type wraps the operations of one instruction set for one precision. Vectors hold the midgame-endgame
+// pairs of lanes / 2 coefficients, so midgame and endgame lanes are interleaved. Float pairs are moved as one
+// 64-bit element by hardware gathers and scatters, double pairs with one 128-bit load or store per coefficient
+struct Avx2Double
+{
+    using real = double;
+    using vec = __m256d;
+    static constexpr size_t lanes = 4;
+
+    static AVX2_TARGET vec zero() { return _mm256_setzero_pd(); }
+    static AVX2_TARGET vec set1(const real value) { return _mm256_set1_pd(value); }
+    static AVX2_TARGET vec set_pair(const real mg, const real eg) { return _mm256_setr_pd(mg, eg, mg, eg); }
+    static AVX2_TARGET vec load(const real* data) { return _mm256_loadu_pd(data); }
+    static AVX2_TARGET void store(real* data, const vec v) { _mm256_storeu_pd(data, v); }
+    static AVX2_TARGET vec add(const vec a, const vec b) { return _mm256_add_pd(a, b); }
+    static AVX2_TARGET vec sub(const vec a, const vec b) { return _mm256_sub_pd(a, b); }
+    static AVX2_TARGET vec mul(const vec a, const vec b) { return _mm256_mul_pd(a, b); }
+    static AVX2_TARGET vec div(const vec a, const vec b) { return _mm256_div_pd(a, b); }
+    static AVX2_TARGET vec min(const vec a, const vec b) { return _mm256_min_pd(a, b); }
+    static AVX2_TARGET vec max(const vec a, const vec b) { return _mm256_max_pd(a, b); }
+    static AVX2_TARGET vec fmadd(const vec a, const vec b, const vec c) { return _mm256_fmadd_pd(a, b, c); }
+    static AVX2_TARGET vec fnmadd(const vec a, const vec b, const vec c) { return _mm256_fnmadd_pd(a, b, c); }
+    static AVX2_TARGET vec round(const vec v) { return _mm256_round_pd(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static AVX2_TARGET vec scale_by_pow2(const vec v, const vec exponent)
+    {
+        const auto exponent64 = _mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(exponent));
+        const auto bits = _mm256_slli_epi64(_mm256_add_epi64(exponent64, _mm256_set1_epi64x(1023)), 52);
+        return _mm256_mul_pd(v, _mm256_castsi256_pd(bits));
+    }
+
+    static AVX2_TARGET vec load_values(const real* values)
+    {
+        return _mm256_permute4x64_pd(_mm256_zextpd128_pd256(_mm_loadu_pd(values)), 0x50);
+    }
+
+    static AVX2_TARGET vec load_pairs(const real* base, const int32_t* indices)
+    {
+        const auto low = _mm_loadu_pd(base + 2 * indices[0]);
+        const auto high = _mm_loadu_pd(base + 2 * indices[1]);
+        return _mm256_insertf128_pd(_mm256_zextpd128_pd256(low), high, 1);
+    }
+
+    static AVX2_TARGET void store_pairs(real* base, const int32_t* indices, const vec v)
+    {
+        _mm_storeu_pd(base + 2 * indices[0], _mm256_castpd256_pd128(v));
+        _mm_storeu_pd(base + 2 * indices[1], _mm256_extractf128_pd(v, 1));
+    }
+
+    static AVX2_TARGET void reduce_pair(const vec v, real& mg, real& eg)
+    {
+        const auto sum = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+        mg = _mm_cvtsd_f64(sum);
+        eg = _mm_cvtsd_f64(_mm_unpackhi_pd(sum, sum));
+    }
+};
+
+struct Avx2Float
+{
+    using real = float;
+    using vec = __m256;
+    static constexpr size_t lanes = 8;
+
+    static AVX2_TARGET vec zero() { return _mm256_setzero_ps(); }
+    static AVX2_TARGET vec set1(const real value) { return _mm256_set1_ps(value); }
+    static AVX2_TARGET vec set_pair(const real mg, const real eg) { return _mm256_setr_ps(mg, eg, mg, eg, mg, eg, mg, eg); }
+    static AVX2_TARGET vec load(const real* data) { return _mm256_loadu_ps(data); }
+    static AVX2_TARGET void store(real* data, const vec v) { _mm256_storeu_ps(data, v); }
+    static AVX2_TARGET vec add(const vec a, const vec b) { return _mm256_add_ps(a, b); }
+    static AVX2_TARGET vec sub(const vec a, const vec b) { return _mm256_sub_ps(a, b); }
+    static AVX2_TARGET vec mul(const vec a, const vec b) { return _mm256_mul_ps(a, b); }
+    static AVX2_TARGET vec div(const vec a, const vec b) { return _mm256_div_ps(a, b); }
+    static AVX2_TARGET vec min(const vec a, const vec b) { return _mm256_min_ps(a, b); }
+    static AVX2_TARGET vec max(const vec a, const vec b) { return _mm256_max_ps(a, b); }
+    static AVX2_TARGET vec fmadd(const vec a, const vec b, const vec c) { return _mm256_fmadd_ps(a, b, c); }
+    static AVX2_TARGET vec fnmadd(const vec a, const vec b, const vec c) { return _mm256_fnmadd_ps(a, b, c); }
+    static AVX2_TARGET vec round(const vec v) { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+    static AVX2_TARGET vec scale_by_pow2(const vec v, const vec exponent)
+    {
+        const auto bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(exponent), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(v, _mm256_castsi256_ps(bits));
+    }
+
+    static AVX2_TARGET vec load_values(const real* values)
+    {
+        return _mm256_permutevar8x32_ps(_mm256_zextps128_ps256(_mm_loadu_ps(values)), _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3));
+    }
+
+    static AVX2_TARGET vec load_pairs(const real* base, const int32_t* indices)
+    {
+        const auto pairs = _mm256_i32gather_pd(reinterpret_cast<const double*>(base), _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices)), 8);
+        return _mm256_castpd_ps(pairs);
+    }
+
+    static AVX2_TARGET void store_pairs(real* base, const int32_t* indices, const vec v)
+    {
+        const auto low = _mm256_castps256_ps128(v);
+        const auto high = _mm256_extractf128_ps(v, 1);
+        _mm_storel_pi(reinterpret_cast<__m64*>(base + 2 * indices[0]), low);
+        _mm_storeh_pi(reinterpret_cast<__m64*>(base + 2 * indices[1]), low);
+        _mm_storel_pi(reinterpret_cast<__m64*>(base + 2 * indices[2]), high);
+        _mm_storeh_pi(reinterpret_cast<__m64*>(base + 2 * indices[3]), high);
+    }
+
+    static AVX2_TARGET void reduce_pair(const vec v, real& mg, real& eg)
+    {
+        const auto quad = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        const auto sum = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));
+        mg = _mm_cvtss_f32(sum);
+        eg = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, 1));
+    }
+};
+
+struct Avx512Double
+{
+    using real = double;
+    using vec = __m512d;
+    static constexpr size_t lanes = 8;
+
+    static AVX512_TARGET vec zero() { return _mm512_setzero_pd(); }
+    static AVX512_TARGET vec set1(const real value) { return _mm512_set1_pd(value); }
+    static AVX512_TARGET vec set_pair(const real mg, const real eg) { return _mm512_set4_pd(eg, mg, eg, mg); }
+    static AVX512_TARGET vec load(const real* data) { return _mm512_loadu_pd(data); }
+    static AVX512_TARGET void store(real* data, const vec v) { _mm512_storeu_pd(data, v); }
+    static AVX512_TARGET vec add(const vec a, const vec b) { return _mm512_add_pd(a, b); }
+    static AVX512_TARGET vec sub(const vec a, const vec b) { return _mm512_sub_pd(a, b); }
+    static AVX512_TARGET vec mul(const vec a, const vec b) { return _mm512_mul_pd(a, b); }
+    static AVX512_TARGET vec div(const vec a, const vec b) { return _mm512_div_pd(a, b); }
+    static AVX512_TARGET vec min(const vec a, const vec b) { return _mm512_min_pd(a, b); }
+    static AVX512_TARGET vec max(const vec a, const vec b) { return _mm512_max_pd(a, b); }
+    static AVX512_TARGET vec fmadd(const vec a, const vec b, const vec c) { return _mm512_fmadd_pd(a, b, c); }
+    static AVX512_TARGET vec fnmadd(const vec a, const vec b, const vec c) { return _mm512_fnmadd_pd(a, b, c); }
+    static AVX512_TARGET vec round(const vec v) { return _mm512_roundscale_pd(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static AVX512_TARGET vec scale_by_pow2(const vec v, const vec exponent) { return _mm512_scalef_pd(v, exponent); }
+
+    static AVX512_TARGET vec load_values(const real* values)
+    {
+        return _mm512_permutexvar_pd(_mm512_setr_epi64(0, 0, 1, 1, 2, 2, 3, 3), _mm512_zextpd256_pd512(_mm256_loadu_pd(values)));
+    }
+
+    static AVX512_TARGET vec load_pairs(const real* base, const int32_t* indices)
+    {
+        const auto low = Avx2Double::load_pairs(base, indices);
+        const auto high = Avx2Double::load_pairs(base, indices + 2);
+        return _mm512_insertf64x4(_mm512_zextpd256_pd512(low), high, 1);
+    }
+
+    static AVX512_TARGET void store_pairs(real* base, const int32_t* indices, const vec v)
+    {
+        Avx2Double::store_pairs(base, indices, _mm512_castpd512_pd256(v));
+        Avx2Double::store_pairs(base, indices + 2, _mm512_extractf64x4_pd(v, 1));
+    }
+
+    static AVX512_TARGET void reduce_pair(const vec v, real& mg, real& eg)
+    {
+        Avx2Double::reduce_pair(_mm256_add_pd(_mm512_castpd512_pd256(v), _mm512_extractf64x4_pd(v, 1)), mg, eg);
+    }
+};
+
+struct Avx512Float
+{
+    using real = float;
+    using vec = __m512;
+    static constexpr size_t lanes = 16;
+
+    static AVX512_TARGET vec zero() { return _mm512_setzero_ps(); }
+    static AVX512_TARGET vec set1(const real value) { return _mm512_set1_ps(value); }
+    static AVX512_TARGET vec set_pair(const real mg, const real eg) { return _mm512_set4_ps(eg, mg, eg, mg); }
+    static AVX512_TARGET vec load(const real* data) { return _mm512_loadu_ps(data); }
+    static AVX512_TARGET void store(real* data, const vec v) { _mm512_storeu_ps(data, v); }
+    static AVX512_TARGET vec add(const vec a, const vec b) { return _mm512_add_ps(a, b); }
+    static AVX512_TARGET vec sub(const vec a, const vec b) { return _mm512_sub_ps(a, b); }
+    static AVX512_TARGET vec mul(const vec a, const vec b) { return _mm512_mul_ps(a, b); }
+    static AVX512_TARGET vec div(const vec a, const vec b) { return _mm512_div_ps(a, b); }
+    static AVX512_TARGET vec min(const vec a, const vec b) { return _mm512_min_ps(a, b); }
+    static AVX512_TARGET vec max(const vec a, const vec b) { return _mm512_max_ps(a, b); }
+    static AVX512_TARGET vec fmadd(const vec a, const vec b, const vec c) { return _mm512_fmadd_ps(a, b, c); }
+    static AVX512_TARGET vec fnmadd(const vec a, const vec b, const vec c) { return _mm512_fnmadd_ps(a, b, c); }
+    static AVX512_TARGET vec round(const vec v) { return _mm512_roundscale_ps(v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+    static AVX512_TARGET vec scale_by_pow2(const vec v, const vec exponent) { return _mm512_scalef_ps(v, exponent); }
+
+    static AVX512_TARGET vec load_values(const real* values)
+    {
+        const auto lanes_to_values = _mm512_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+        return _mm512_permutexvar_ps(lanes_to_values, _mm512_zextps256_ps512(_mm256_loadu_ps(values)));
+    }
+
+    static AVX512_TARGET vec load_pairs(const real* base, const int32_t* indices)
+    {
+        const auto pairs = _mm512_i32gather_pd(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), reinterpret_cast<const double*>(base), 8);
+        return _mm512_castpd_ps(pairs);
+    }
+
+    static AVX512_TARGET void store_pairs(real* base, const int32_t* indices, const vec v)
+    {
+        _mm512_i32scatter_pd(reinterpret_cast<double*>(base), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices)), _mm512_castps_pd(v), 8);
+    }
+
+    static AVX512_TARGET void reduce_pair(const vec v, real& mg, real& eg)
+    {
+        const auto high = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+        Avx2Float::reduce_pair(_mm256_add_ps(_mm512_castps512_ps256(v), high), mg, eg);
+    }
+};
+
+static constexpr double inverse_factorial(const int32_t n)
+{
+    double factorial = 1;
+    for (int32_t i = 2; i <= n; i++)
+    {
+        factorial *= i;
+    }
+    return 1 / factorial;
+}
+
+// GCC warns that the generic functions call the SIMD types with AVX and AVX-512 vectors in an ABI that depends on
+// the target, which never applies to them since they are always inlined. The warning is disabled for them alone
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// Replaces x with exp(x) = 2^n * exp(r) with |r| <= ln(2) / 2, exp(r) is a Taylor polynomial that is accurate
+// to about one ulp of the precision. x is clamped so the result stays a normal number. x is updated in place because
+// GCC checks a returned vector at the end of the file, where the warning could not be disabled for this function alone
+template<typename Simd>
+SIMD_INLINE void simd_exp(typename Simd::vec& x)
+{
+    using Real = typename Simd::real;
+    constexpr bool is_double = is_same_v<Real, double>;
+    constexpr int32_t degree = is_double ? 13 : 7;
+    constexpr Real ln2_high = is_double ? 0.693145751953125 : 0.693359375f;
+    constexpr Real ln2_low = is_double ? 1.42860682030941723212e-6 : -2.12194440e-4f;
+    constexpr Real exponent_limit = is_double ? 708 : 87;
+
+    x = Simd::min(Simd::max(x, Simd::set1(-exponent_limit)), Simd::set1(exponent_limit));
+    const auto n = Simd::round(Simd::mul(x, Simd::set1(static_cast<Real>(1.44269504088896340736))));
+    const auto r = Simd::fnmadd(n, Simd::set1(ln2_low), Simd::fnmadd(n, Simd::set1(ln2_high), x));
+
+    auto polynomial = Simd::set1(static_cast<Real>(inverse_factorial(degree)));
+    for (int32_t power = degree - 1; power >= 0; power--)
+    {
+        polynomial = Simd::fmadd(polynomial, r, Simd::set1(static_cast<Real>(inverse_factorial(power))));
+    }
+    x = Simd::scale_by_pow2(polynomial, n);
+}
+
+// Decodes the coefficients of one entry into indices and values and returns their count. While the next 16 bytes
+// are eight one byte values with one byte gaps, which is by far the most common case, eight coefficients are
+// decoded at once, the index of each is the running sum of gap + 1
+template<typename Real>
+AVX2_TARGET inline size_t decode_row(const uint8_t* data, const uint8_t* end, int32_t* indices, Real* values)
+{
+    const auto value_bytes = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto gap_bytes = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+    const auto escape = _mm_set1_epi8(static_cast<char>(coefficient_value_escape));
+
+    size_t count = 0;
+    int32_t index = -1;
+    while (data != end)
+    {
+        while (end - data >= 16)
+        {
+            const auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+            const auto escaped_values = _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, escape)) & 0x5555;
+            const auto long_gaps = _mm_movemask_epi8(bytes) & 0xAAAA;
+            if (escaped_values | long_gaps)
+            {
+                break;
+            }
+
+            auto steps = _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_shuffle_epi8(bytes, gap_bytes)), _mm256_set1_epi32(1));
+            steps = _mm256_add_epi32(steps, _mm256_slli_si256(steps, 4));
+            steps = _mm256_add_epi32(steps, _mm256_slli_si256(steps, 8));
+            const auto low_total = _mm256_permutevar8x32_epi32(steps, _mm256_set1_epi32(3));
+            steps = _mm256_add_epi32(steps, _mm256_blend_epi32(_mm256_setzero_si256(), low_total, 0xF0));
+            const auto coefficient_indices = _mm256_add_epi32(steps, _mm256_set1_epi32(index));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(indices + count), coefficient_indices);
+            index = _mm256_extract_epi32(coefficient_indices, 7);
+
+            const auto coefficient_values = _mm256_cvtepi8_epi32(_mm_shuffle_epi8(bytes, value_bytes));
+            if constexpr (is_same_v<Real, double>)
+            {
+                _mm256_storeu_pd(values + count, _mm256_cvtepi32_pd(_mm256_castsi256_si128(coefficient_values)));
+                _mm256_storeu_pd(values + count + 4, _mm256_cvtepi32_pd(_mm256_extracti128_si256(coefficient_values, 1)));
+            }
+            else
+            {
+                _mm256_storeu_ps(values + count, _mm256_cvtepi32_ps(coefficient_values));
+            }
+
+            count += 8;
+            data += 16;
+        }
+
+        if (data == end)
+        {
+            break;
+        }
+
+        int32_t value;
+        uint32_t index_gap;
+        decode_coefficient(data, value, index_gap);
+        index += static_cast<int32_t>(index_gap) + 1;
+        indices[count] = index;
+        values[count] = static_cast<Real>(value);
+        count++;
+    }
+
+    return count;
+}
+
+// Positions handled together, the sigmoid is computed for all of them at once
+constexpr size_t simd_block_size = 16;
+
+// Rows of a block are decoded once into index and value arrays, which both the dot products and the gradient
+// scatter read. Each row is padded to whole vectors with coefficients of 0 for the extra parameter past the
+// end. The indices of a row are unique, so storing the pairs of one vector never has two lanes writing the
+// same gradient, except for padding lanes that all write back the same value
+template<typename Simd>
+SIMD_INLINE void simd_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<typename Simd::real>& parameters,
+                              const typename Simd::real K, kernel_parameters_t<typename Simd::real>* gradient, RangeOutput<typename Simd::real>& output)
+{
+    using Real = typename Simd::real;
+    static_assert(simd_block_size % Simd::lanes == 0);
+    constexpr size_t coefficients_per_vector = Simd::lanes / 2;
+
+    const auto padding_index = static_cast<int32_t>(parameters.size() - 1);
+    const Real* parameter_data = parameters[0].data();
+    Real* gradient_data = gradient != nullptr ? (*gradient)[0].data() : nullptr;
+
+    thread_local vector<int32_t> indices;
+    thread_local vector<Real> values;
+    array<size_t, simd_block_size + 1> row_starts;
+    alignas(64) array<Real, simd_block_size> evals;
+    alignas(64) array<Real, simd_block_size> wdls;
+    alignas(64) array<Real, simd_block_size> diffs;
+    alignas(64) array<Real, simd_block_size> residuals;
+
+    for (size_t block_begin = begin; block_begin < end; block_begin += simd_block_size)
+    {
+        const auto block_count = min(simd_block_size, end - block_begin);
+
+        // Every coefficient takes at least two encoded bytes
+        const auto max_coefficients = (entries.offsets[block_begin + block_count] - entries.offsets[block_begin]) / 2 + block_count * coefficients_per_vector;
+        if (values.size() < max_coefficients)
+        {
+            indices.resize(max_coefficients);
+            values.resize(max_coefficients);
+        }
+
+        size_t coefficient_count = 0;
+        for (size_t row = 0; row < block_count; row++)
+        {
+            row_starts[row] = coefficient_count;
+            const auto entry_index = block_begin + row;
+            const auto coefficients_begin = entries.coefficients.data() + entries.offsets[entry_index];
+            const auto coefficients_end = entries.coefficients.data() + entries.offsets[entry_index + 1];
+            coefficient_count += decode_row(coefficients_begin, coefficients_end, &indices[coefficient_count], &values[coefficient_count]);
+            while (coefficient_count % coefficients_per_vector != 0)
+            {
+                indices[coefficient_count] = padding_index;
+                values[coefficient_count] = 0;
+                coefficient_count++;
+            }
+        }
+        row_starts[block_count] = coefficient_count;
+
+        for (size_t row = 0; row < simd_block_size; row++)
+        {
+            if (row >= block_count)
+            {
+                evals[row] = 0;
+                wdls[row] = 0;
+                continue;
+            }
+
+            auto sum = Simd::zero();
+            for (auto coefficient = row_starts[row]; coefficient < row_starts[row + 1]; coefficient += coefficients_per_vector)
+            {
+                sum = Simd::fmadd(Simd::load_pairs(parameter_data, &indices[coefficient]), Simd::load_values(&values[coefficient]), sum);
+            }
+
+            Real midgame;
+            Real endgame;
+            Simd::reduce_pair(sum, midgame, endgame);
+            const auto& header = entries.headers[block_begin + row];
+            evals[row] = static_cast<Real>(header.additional_score) + midgame * static_cast<Real>(header.midgame_weight) + endgame * static_cast<Real>(header.endgame_weight);
+            wdls[row] = static_cast<Real>(header.get_wdl());
+        }
+
+        const auto sigmoid_scale = Simd::set1(-K / static_cast<Real>(400));
+        const auto one = Simd::set1(1);
+        for (size_t row = 0; row < simd_block_size; row += Simd::lanes)
+        {
+            auto exponential = Simd::mul(Simd::load(&evals[row]), sigmoid_scale);
+            simd_exp<Simd>(exponential);
+            const auto sig = Simd::div(one, Simd::add(one, exponential));
+            const auto diff = Simd::sub(Simd::load(&wdls[row]), sig);
+            Simd::store(&diffs[row], diff);
+            Simd::store(&residuals[row], Simd::mul(Simd::mul(diff, sig), Simd::sub(one, sig)));
+        }
+
+        for (size_t row = 0; row < block_count; row++)
+        {
+            output.error.add(diffs[row] * diffs[row]);
+        }
+
+        if (output.residuals != nullptr)
+        {
+            copy_n(residuals.begin(), block_count, output.residuals + (block_begin - begin));
+        }
+
+        if (gradient_data == nullptr)
+        {
+            continue;
+        }
+
+        for (size_t row = 0; row < block_count; row++)
+        {
+            const auto& header = entries.headers[block_begin + row];
+            const auto base = Simd::set_pair(residuals[row] * static_cast<Real>(header.midgame_weight), residuals[row] * static_cast<Real>(header.endgame_weight));
+            for (auto coefficient = row_starts[row]; coefficient < row_starts[row + 1]; coefficient += coefficients_per_vector)
+            {
+                const auto coefficient_indices = &indices[coefficient];
+                const auto gradient_pairs = Simd::load_pairs(gradient_data, coefficient_indices);
+                Simd::store_pairs(gradient_data, coefficient_indices, Simd::fmadd(Simd::load_values(&values[coefficient]), base, gradient_pairs));
+            }
+        }
+    }
+}
+
+#pragma GCC diagnostic pop
+
+AVX2_TARGET __attribute__((flatten))
+static void avx2_double_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<double>& parameters,
+                     const double K, kernel_parameters_t<double>* gradient, RangeOutput<double>& output)
+{
+    simd_range_kernel<Avx2Double>(entries, begin, end, parameters, K, gradient, output);
+}
+
+AVX2_TARGET __attribute__((flatten))
+static void avx2_float_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<float>& parameters,
+                     const float K, kernel_parameters_t<float>* gradient, RangeOutput<float>& output)
+{
+    simd_range_kernel<Avx2Float>(entries, begin, end, parameters, K, gradient, output);
+}
+
+AVX512_TARGET __attribute__((flatten))
+static void avx512_double_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<double>& parameters,
+                     const double K, kernel_parameters_t<double>* gradient, RangeOutput<double>& output)
+{
+    simd_range_kernel<Avx512Double>(entries, begin, end, parameters, K, gradient, output);
+}
+
+AVX512_TARGET __attribute__((flatten))
+static void avx512_float_range_kernel(const EntrySet& entries, const size_t begin, const size_t end, const kernel_parameters_t<float>& parameters,
+                     const float K, kernel_parameters_t<float>* gradient, RangeOutput<float>& output)
+{
+    simd_range_kernel<Avx512Float>(entries, begin, end, parameters, K, gradient, output);
+}
+
+#endif
+
+KernelIsa get_default_kernel_isa()
+{
+#if SIMD_KERNELS
+    if constexpr (enable_simd)
+    {
+        __builtin_cpu_init();
+        const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        if (avx2 && __builtin_cpu_supports("avx512f"))
+        {
+            return KernelIsa::Avx512;
+        }
+        if (avx2)
+        {
+            return KernelIsa::Avx2;
+        }
+    }
+#endif
+    return KernelIsa::Scalar;
+}
+
+const char* get_kernel_isa_name(const KernelIsa isa)
+{
+    switch (isa)
+    {
+    case KernelIsa::Avx2:
+        return "AVX2";
+    case KernelIsa::Avx512:
+        return "AVX-512";
+    default:
+        return "scalar";
+    }
+}
+
+template<typename Real>
+range_kernel_t<Real> get_range_kernel(const KernelIsa isa)
+{
+#if SIMD_KERNELS
+    if (isa == KernelIsa::Avx512)
+    {
+        if constexpr (is_same_v<Real, double>)
+        {
+            return avx512_double_range_kernel;
+        }
+        else
+        {
+            return avx512_float_range_kernel;
+        }
+    }
+    if (isa == KernelIsa::Avx2)
+    {
+        if constexpr (is_same_v<Real, double>)
+        {
+            return avx2_double_range_kernel;
+        }
+        else
+        {
+            return avx2_float_range_kernel;
+        }
+    }
+#endif
+    return scalar_range_kernel<Real>;
+}
+
+template range_kernel_t<float> get_range_kernel<float>(KernelIsa isa);
+template range_kernel_t<double> get_range_kernel<double>(KernelIsa isa);
@@ -0,0 +1,116 @@
+#ifndef KERNELS_H
+#define KERNELS_H 1
+
+#include "base.h"
+#include "dataset.h"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Parameters as used by the per entry math, in either tune_t or a narrower type
+#if TAPERED
+template<typename Real>
+using kernel_parameters_t = std::vector<std::array<Real, 2>>;
+#else
+template<typename Real>
+using kernel_parameters_t = std::vector<Real>;
+#endif
+
+// Range kernels read and write one parameter past the end, padded vector lanes point there so they never
+// touch a real parameter. Parameters and gradients passed to a range kernel need this extra zero entry
+template<typename Real>
+void get_kernel_parameters(const parameters_t& parameters, kernel_parameters_t<Real>& kernel_parameters)
+{
+    kernel_parameters.assign(parameters.size() + 1, {});
+    for (size_t parameter_index = 0; parameter_index < parameters.size(); parameter_index++)
+    {
+#if TAPERED
+        kernel_parameters[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] = static_cast<Real>(parameters[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)]);
+        kernel_parameters[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] = static_cast<Real>(parameters[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)]);
+#else
+        kernel_parameters[parameter_index] = static_cast<Real>(parameters[parameter_index]);
+#endif
+    }
+}
+
+template<typename Real>
+Real linear_eval(const EntrySet& entries, const size_t entry_index, const kernel_parameters_t<Real>& parameters)
+{
+    const auto coefficients_begin = entries.coefficients.data() + entries.offsets[entry_index];
+    const auto coefficients_end = entries.coefficients.data() + entries.offsets[entry_index + 1];
+
+    const auto& header = entries.headers[entry_index];
+    Real score = static_cast<Real>(header.additional_score);
+#if TAPERED
+    Real midgame = 0;
+    Real endgame = 0;
+    decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t index)
+    {
+        midgame += static_cast<Real>(value) * parameters[index][static_cast<int32_t>(PhaseStages::Midgame)];
+        endgame += static_cast<Real>(value) * parameters[index][static_cast<int32_t>(PhaseStages::Endgame)];
+    });
+    score += midgame * static_cast<Real>(header.midgame_weight) + endgame * static_cast<Real>(header.endgame_weight);
+#else
+    decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t index)
+    {
+        score += static_cast<Real>(value) * parameters[index];
+    });
+#endif
+
+    return score;
+}
+
+template<typename Real>
+Real sigmoid(const Real K, const Real eval)
+{
+    return static_cast<Real>(1) / (static_cast<Real>(1) + std::exp(-K * eval / static_cast<Real>(400)));
+}
+
+// Kahan summation, the rounding error of the sum does not grow with the number of terms
+template<typename Real>
+struct CompensatedSum
+{
+    Real sum = 0;
+    Real compensation = 0;
+
+    void add(const Real value)
+    {
+        const Real corrected = value - compensation;
+        const Real next_sum = sum + corrected;
+        compensation = (next_sum - sum) - corrected;
+        sum = next_sum;
+    }
+};
+
+template<typename Real>
+struct RangeOutput
+{
+    CompensatedSum<Real> error;
+    // If set, receives the residual of every entry of the range, indexed from the start of the range
+    Real* residuals = nullptr;
+};
+
+// Evaluates the entries [begin, end). With residual = (wdl - sigmoid) * sigmoid * (1 - sigmoid), adds their
+// squared errors to output.error and their gradient sums to gradient unless it is null
+template<typename Real>
+using range_kernel_t = void (*)(const EntrySet& entries, size_t begin, size_t end, const kernel_parameters_t<Real>& parameters,
+                                Real K, kernel_parameters_t<Real>* gradient, RangeOutput<Real>& output);
+
+enum class KernelIsa
+{
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+// The best kernel set the CPU supports, or the scalar reference kernels if enable_simd is off
+KernelIsa get_default_kernel_isa();
+const char* get_kernel_isa_name(KernelIsa isa);
+
+template<typename Real>
+range_kernel_t<Real> get_range_kernel(KernelIsa isa);
+
+#endif // !KERNELS_H
@@ -0,0 +1,89 @@
+#include "line_reader.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+bool LineReader::open(const string& path)
+{
+    mapped_offset = 0;
+    buffered_size = 0;
+    consumed_size = 0;
+
+    if (mapped_file.open(path))
+    {
+        use_stream = false;
+        mapped_file.advise_sequential();
+        return true;
+    }
+
+    stream.open(path, ios::binary);
+    use_stream = static_cast<bool>(stream);
+    return use_stream;
+}
+
+bool LineReader::is_mapped() const
+{
+    return !use_stream;
+}
+
+string_view LineReader::next_block(const size_t max_size)
+{
+    if (!use_stream)
+    {
+        const auto remaining = mapped_file.size() - mapped_offset;
+        if (remaining == 0)
+        {
+            return {};
+        }
+
+        const auto block_begin = mapped_file.data() + mapped_offset;
+        auto block_size = min(max_size, remaining);
+        if (block_size < remaining)
+        {
+            // Extend the block to the end of the line it stops in
+            const auto line_end = static_cast<const char*>(memchr(block_begin + block_size, '\n', remaining - block_size));
+            block_size = line_end == nullptr ? remaining : static_cast<size_t>(line_end - block_begin) + 1;
+        }
+
+        mapped_offset += block_size;
+        return {block_begin, block_size};
+    }
+
+    // Keep the partial line left over from the previous block and refill behind it
+    const auto leftover_size = buffered_size - consumed_size;
+    memmove(buffer.data(), buffer.data() + consumed_size, leftover_size);
+    buffered_size = leftover_size;
+    consumed_size = 0;
+
+    while (true)
+    {
+        if (buffer.size() < max(max_size, buffered_size + 1))
+        {
+            buffer.resize(max(max_size, buffered_size * 2));
+        }
+
+        if (stream)
+        {
+            stream.read(buffer.data() + buffered_size, static_cast<streamsize>(buffer.size() - buffered_size));
+            buffered_size += static_cast<size_t>(stream.gcount());
+        }
+
+        const string_view contents(buffer.data(), buffered_size);
+        if (!stream)
+        {
+            consumed_size = buffered_size;
+            return contents;
+        }
+
+        const auto last_line_end = contents.rfind('\n');
+        if (last_line_end != string_view::npos)
+        {
+            consumed_size = last_line_end + 1;
+            return contents.substr(0, consumed_size);
+        }
+
+        // A single line longer than the buffer, grow it and keep reading
+    }
+}
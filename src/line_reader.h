@@ -0,0 +1,62 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H 1
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Reads a text file in blocks of whole lines. Regular files are memory mapped and the blocks point
+// straight into the mapping, anything that can't be mapped (pipes, devices) is read through a buffer
+class LineReader {
+public:
+    bool open(const std::string& path);
+    bool is_mapped() const;
+
+    // Returns the next run of complete lines, roughly max_size bytes long, or an empty view at the end of the input.
+    // The view stays valid until the next call
+    std::string_view next_block(size_t max_size);
+
+private:
+    MappedFile mapped_file;
+    size_t mapped_offset = 0;
+
+    std::ifstream stream;
+    std::vector<char> buffer;
+    size_t buffered_size = 0;
+    size_t consumed_size = 0;
+    bool use_stream = false;
+};
+
+// Trims the line terminator, so both \n and \r\n files give the same lines
+inline std::string_view trim_line_end(std::string_view line)
+{
+    if (!line.empty() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+    return line;
+}
+
+// Calls line_handler with every line of the block, without its line terminator
+template<typename F>
+void for_each_line(std::string_view block, F&& line_handler)
+{
+    while (!block.empty())
+    {
+        const auto line_end = block.find('\n');
+        const auto line = block.substr(0, line_end);
+        line_handler(trim_line_end(line));
+
+        if (line_end == std::string_view::npos)
+        {
+            break;
+        }
+        block.remove_prefix(line_end + 1);
+    }
+}
+
+#endif // !LINE_READER_H
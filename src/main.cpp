@@ -1,79 +1,115 @@
 #include "tuner.h"
+#include "line_reader.h"
 
-#include <fstream>
+#include <array>
+#include <cctype>
+#include <charconv>
 #include <iostream>
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <vector>
 
 using namespace std;
 using namespace Tuner;
 
+static size_t split_fields(string_view line, array<string_view, 3>& fields)
+{
+    size_t field_count = 0;
+    while (field_count < fields.size())
+    {
+        const auto comma = line.find(',');
+        fields[field_count++] = line.substr(0, comma);
+        if (comma == string_view::npos)
+        {
+            break;
+        }
+        line.remove_prefix(comma + 1);
+    }
+    return field_count;
+}
+
+template<typename T>
+static bool parse_number(string_view text, T& value)
+{
+    while (!text.empty() && isspace(static_cast<unsigned char>(text.front())))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && isspace(static_cast<unsigned char>(text.back())))
+    {
+        text.remove_suffix(1);
+    }
+
+    const auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
 int main(int argc, char** argv) {
+    int arg_index = 1;
+    const bool run_benchmark = argc > arg_index && string_view(argv[arg_index]) == "bench";
+    if (run_benchmark)
+    {
+        arg_index++;
+    }
+
     vector<DataSource> sources;
     {
         string csv_path = "sources.csv";
-        if (argc > 1)
+        if (argc > arg_index)
         {
-            csv_path = argv[1];
+            csv_path = argv[arg_index];
         }
-        ifstream csv(csv_path);
-        if(!csv)
+        LineReader csv;
+        if(!csv.open(csv_path))
         {
             cout << "Unable to open data source list " << csv_path << endl;
         }
 
-        while(!csv.eof())
+        bool csv_valid = true;
+        constexpr size_t csv_block_size = 1 << 16;
+        for (auto block = csv.next_block(csv_block_size); csv_valid && !block.empty(); block = csv.next_block(csv_block_size))
         {
-            string line;
-            getline(csv, line);
-
-            if(line.empty() || line.starts_with('#'))
+            for_each_line(block, [&](const string_view line)
             {
-                continue;
-            }
+                if(!csv_valid || line.empty() || line.starts_with('#'))
+                {
+                    return;
+                }
 
-            DataSource source;
-            stringstream ss(line);
-            if(!getline(ss, source.path, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
+                array<string_view, 3> fields;
+                if (split_fields(line, fields) < fields.size())
+                {
+                    cout << "CSV misformatted" << endl;
+                    csv_valid = false;
+                    return;
+                }
 
-            string flipped_wdl_str;
-            if (!getline(ss, flipped_wdl_str, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
-            try
-            {
-                source.side_to_move_wdl = stoul(flipped_wdl_str);
-            }
-            catch (const std::invalid_argument&)
-            {
-                cout << flipped_wdl_str << " is not valid for a WDL flip flag";
-                return -1;
-            }
+                DataSource source;
+                source.path = fields[0];
 
-            string position_limit_str;
-            if (!getline(ss, flipped_wdl_str, ','))
-            {
-                cout << "CSV misformatted" << endl;
-                return -1;
-            }
-            try
-            {
-                source.position_limit = stoll(flipped_wdl_str);
-            }
-            catch (const std::invalid_argument&)
-            {
-                cout << position_limit_str << " is not a valid position limit";
-                return -1;
-            }
+                uint32_t flipped_wdl;
+                if (!parse_number(fields[1], flipped_wdl))
+                {
+                    cout << fields[1] << " is not valid for a WDL flip flag";
+                    csv_valid = false;
+                    return;
+                }
+                source.side_to_move_wdl = flipped_wdl != 0;
+
+                if (!parse_number(fields[2], source.position_limit))
+                {
+                    cout << fields[2] << " is not a valid position limit";
+                    csv_valid = false;
+                    return;
+                }
 
-            sources.push_back(source);
+                sources.push_back(source);
+            });
+        }
+
+        if (!csv_valid)
+        {
+            return -1;
         }
     }
 
@@ -83,7 +119,14 @@ int main(int argc, char** argv) {
         return -1;
     }
 
-    run(sources);
+    if (run_benchmark)
+    {
+        benchmark(sources);
+    }
+    else
+    {
+        run(sources);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,119 @@
+#include "mapped_file.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const string& path)
+{
+    close();
+
+#ifndef _WIN32
+    const int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat file_stat {};
+    if (fstat(descriptor, &file_stat) != 0 || !S_ISREG(file_stat.st_mode))
+    {
+        ::close(descriptor);
+        return false;
+    }
+
+    mapped_size = static_cast<size_t>(file_stat.st_size);
+    if (mapped_size == 0)
+    {
+        ::close(descriptor);
+        opened = true;
+        return true;
+    }
+
+    void* mapping = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    ::close(descriptor);
+    if (mapping == MAP_FAILED)
+    {
+        mapped_size = 0;
+        return false;
+    }
+
+    mapped_data = static_cast<const char*>(mapping);
+    is_mapped = true;
+    opened = true;
+    return true;
+#else
+    ifstream file(path, ios::binary | ios::ate);
+    if (!file)
+    {
+        return false;
+    }
+
+    buffer.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+    if (!file)
+    {
+        buffer.clear();
+        return false;
+    }
+
+    mapped_data = buffer.data();
+    mapped_size = buffer.size();
+    opened = true;
+    return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#ifndef _WIN32
+    if (is_mapped)
+    {
+        munmap(const_cast<char*>(mapped_data), mapped_size);
+    }
+#endif
+    mapped_data = nullptr;
+    mapped_size = 0;
+    is_mapped = false;
+    opened = false;
+    buffer.clear();
+}
+
+bool MappedFile::is_open() const
+{
+    return opened;
+}
+
+// Lets the kernel read ahead aggressively and drop pages behind the reader early
+void MappedFile::advise_sequential() const
+{
+#ifndef _WIN32
+    if (is_mapped)
+    {
+        madvise(const_cast<char*>(mapped_data), mapped_size, MADV_SEQUENTIAL);
+    }
+#endif
+}
+
+const char* MappedFile::data() const
+{
+    return mapped_data;
+}
+
+size_t MappedFile::size() const
+{
+    return mapped_size;
+}
@@ -0,0 +1,31 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H 1
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap where available, otherwise the file is read into memory
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const;
+    void advise_sequential() const;
+    const char* data() const;
+    size_t size() const;
+
+private:
+    const char* mapped_data = nullptr;
+    size_t mapped_size = 0;
+    bool is_mapped = false;
+    bool opened = false;
+    std::vector<char> buffer;
+};
+
+#endif // !MAPPED_FILE_H
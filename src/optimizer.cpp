@@ -0,0 +1,428 @@
+#include "optimizer.h"
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+void NormalMatrix::reset(const size_t variables, const bool full_matrix)
+{
+    full = full_matrix;
+    variable_count = variables;
+    const auto value_count = full ? variable_count * variable_count : variable_count * phase_count;
+    values.assign(value_count, 0);
+}
+
+static tune_t dot(const vector<tune_t>& a, const vector<tune_t>& b)
+{
+    tune_t sum = 0;
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void copy_variables(const parameters_t& parameters, vector<tune_t>& variables)
+{
+    const auto data = get_variables(parameters);
+    variables.assign(data, data + parameters.size() * phase_count);
+}
+
+class AdamOptimizer : public Optimizer
+{
+public:
+    tune_t step(Objective& objective, parameters_t& parameters) override
+    {
+        constexpr tune_t beta1 = 0.9;
+        constexpr tune_t beta2 = 0.999;
+
+        const auto variable_count = parameters.size() * phase_count;
+        if (momentum.size() != variable_count)
+        {
+            momentum.assign(variable_count, 0);
+            velocity.assign(variable_count, 0);
+        }
+
+        const auto error = objective.evaluate(parameters, &gradient);
+        const auto variables = get_variables(parameters);
+        const auto gradients = get_variables(gradient);
+        for (size_t variable = 0; variable < variable_count; variable++)
+        {
+            const auto grad = gradients[variable];
+            momentum[variable] = beta1 * momentum[variable] + (1 - beta1) * grad;
+            velocity[variable] = beta2 * velocity[variable] + (1 - beta2) * grad * grad;
+            variables[variable] -= learning_rate * momentum[variable] / (static_cast<tune_t>(1e-8) + sqrt(velocity[variable]));
+        }
+        return error;
+    }
+
+    void scale_step_size(const tune_t ratio) override
+    {
+        learning_rate *= ratio;
+    }
+
+    string get_status() const override
+    {
+        ostringstream status;
+        status << "LR " << learning_rate;
+        return status.str();
+    }
+
+private:
+    vector<tune_t> momentum;
+    vector<tune_t> velocity;
+    parameters_t gradient;
+    tune_t learning_rate = 1;
+};
+
+// Limited memory BFGS with a backtracking line search. The first direction has no curvature history to scale it,
+// it is the gradient scaled so that no variable moves by more than initial_step
+class LbfgsOptimizer : public Optimizer
+{
+public:
+    tune_t step(Objective& objective, parameters_t& parameters) override
+    {
+        constexpr size_t history_size = 10;
+        constexpr tune_t initial_step = 1;
+        constexpr tune_t sufficient_decrease = 1e-4;
+        constexpr int32_t max_line_search_steps = 20;
+
+        if (!has_current)
+        {
+            current_error = objective.evaluate(parameters, &gradient_parameters);
+            copy_variables(gradient_parameters, gradient);
+            has_current = true;
+        }
+        const auto error = current_error;
+
+        get_direction(initial_step);
+        auto slope = dot(gradient, direction);
+        if (slope >= 0)
+        {
+            history.clear();
+            get_direction(initial_step);
+            slope = dot(gradient, direction);
+        }
+
+        vector<tune_t> start;
+        copy_variables(parameters, start);
+        const auto variables = get_variables(parameters);
+        step_size = 1;
+        for (int32_t line_search_step = 0; line_search_step < max_line_search_steps; line_search_step++)
+        {
+            for (size_t variable = 0; variable < start.size(); variable++)
+            {
+                variables[variable] = start[variable] + step_size * direction[variable];
+            }
+
+            const auto trial_error = objective.evaluate(parameters, &gradient_parameters);
+            if (trial_error <= current_error + sufficient_decrease * step_size * slope)
+            {
+                HistoryEntry entry;
+                copy_variables(gradient_parameters, entry.gradient_change);
+                entry.step.resize(start.size());
+                for (size_t variable = 0; variable < start.size(); variable++)
+                {
+                    entry.step[variable] = step_size * direction[variable];
+                    entry.gradient_change[variable] -= gradient[variable];
+                }
+
+                // Pairs without positive curvature would make the inverse Hessian estimate indefinite
+                const auto curvature = dot(entry.step, entry.gradient_change);
+                if (curvature > numeric_limits<tune_t>::epsilon() * dot(entry.gradient_change, entry.gradient_change))
+                {
+                    entry.rho = 1 / curvature;
+                    history.push_back(move(entry));
+                    if (history.size() > history_size)
+                    {
+                        history.pop_front();
+                    }
+                }
+
+                copy_variables(gradient_parameters, gradient);
+                current_error = trial_error;
+                return error;
+            }
+            step_size /= 2;
+        }
+
+        // No step decreased the error, start over from the gradient next time
+        copy(start.begin(), start.end(), variables);
+        history.clear();
+        step_size = 0;
+        return error;
+    }
+
+    string get_status() const override
+    {
+        ostringstream status;
+        status << "step " << step_size << ", history " << history.size();
+        return status.str();
+    }
+
+private:
+    struct HistoryEntry
+    {
+        vector<tune_t> step;
+        vector<tune_t> gradient_change;
+        tune_t rho = 0;
+    };
+
+    deque<HistoryEntry> history;
+    parameters_t gradient_parameters;
+    vector<tune_t> gradient;
+    vector<tune_t> direction;
+    vector<tune_t> alphas;
+    tune_t current_error = 0;
+    tune_t step_size = 0;
+    bool has_current = false;
+
+    // Two loop recursion, direction = -H * gradient for the inverse Hessian estimate H of the history
+    void get_direction(const tune_t initial_step)
+    {
+        direction = gradient;
+        alphas.resize(history.size());
+        for (size_t entry_index = history.size(); entry_index-- > 0;)
+        {
+            const auto& entry = history[entry_index];
+            alphas[entry_index] = entry.rho * dot(entry.step, direction);
+            for (size_t variable = 0; variable < direction.size(); variable++)
+            {
+                direction[variable] -= alphas[entry_index] * entry.gradient_change[variable];
+            }
+        }
+
+        tune_t scale;
+        if (history.empty())
+        {
+            tune_t max_gradient = 0;
+            for (const auto value : gradient)
+            {
+                max_gradient = max(max_gradient, fabs(value));
+            }
+            scale = max_gradient > 0 ? initial_step / max_gradient : 0;
+        }
+        else
+        {
+            const auto& latest = history.back();
+            scale = dot(latest.step, latest.gradient_change) / dot(latest.gradient_change, latest.gradient_change);
+        }
+        for (auto& value : direction)
+        {
+            value *= scale;
+        }
+
+        for (size_t entry_index = 0; entry_index < history.size(); entry_index++)
+        {
+            const auto& entry = history[entry_index];
+            const auto beta = entry.rho * dot(entry.gradient_change, direction);
+            for (size_t variable = 0; variable < direction.size(); variable++)
+            {
+                direction[variable] += (alphas[entry_index] - beta) * entry.step[variable];
+            }
+        }
+
+        for (auto& value : direction)
+        {
+            value = -value;
+        }
+    }
+};
+
+// Solves matrix * x = rhs in place of rhs for a symmetric positive definite matrix given by its upper triangle,
+// which is overwritten by its Cholesky factor U with matrix = U^T * U. Returns false if the matrix is not
+// positive definite
+static bool cholesky_solve(vector<tune_t>& matrix, const size_t n, vector<tune_t>& rhs)
+{
+    for (size_t k = 0; k < n; k++)
+    {
+        auto row_k = &matrix[k * n];
+        if (!(row_k[k] > 0))
+        {
+            return false;
+        }
+
+        const auto pivot = sqrt(row_k[k]);
+        row_k[k] = pivot;
+        for (size_t j = k + 1; j < n; j++)
+        {
+            row_k[j] /= pivot;
+        }
+
+        // Right looking update of the trailing upper triangle, row by row so the inner loop is contiguous
+        for (size_t i = k + 1; i < n; i++)
+        {
+            const auto factor = row_k[i];
+            if (factor == 0)
+            {
+                continue;
+            }
+
+            auto row_i = &matrix[i * n];
+            for (size_t j = i; j < n; j++)
+            {
+                row_i[j] -= factor * row_k[j];
+            }
+        }
+    }
+
+    // U^T * y = rhs
+    for (size_t k = 0; k < n; k++)
+    {
+        const auto row_k = &matrix[k * n];
+        rhs[k] /= row_k[k];
+        for (size_t j = k + 1; j < n; j++)
+        {
+            rhs[j] -= row_k[j] * rhs[k];
+        }
+    }
+
+    // U * x = y
+    for (size_t i = n; i-- > 0;)
+    {
+        const auto row_i = &matrix[i * n];
+        tune_t sum = rhs[i];
+        for (size_t j = i + 1; j < n; j++)
+        {
+            sum -= row_i[j] * rhs[j];
+        }
+        rhs[i] = sum / row_i[i];
+    }
+    return true;
+}
+
+bool solve_normal_equations(const NormalMatrix& normal, const tune_t damping, vector<tune_t>& right_hand_side)
+{
+    // Variables without any coefficient have a zero diagonal, the floor keeps the system solvable
+    constexpr tune_t diagonal_floor_ratio = 1e-9;
+
+    const auto variable_count = normal.variable_count;
+    vector<tune_t> diagonal(variable_count);
+    for (size_t variable = 0; variable < variable_count; variable++)
+    {
+        diagonal[variable] = normal.full ? normal.values[variable * variable_count + variable]
+                                         : normal.values[variable * phase_count + variable % phase_count];
+    }
+    const auto diagonal_floor = diagonal_floor_ratio * max(*max_element(diagonal.begin(), diagonal.end()), numeric_limits<tune_t>::min());
+
+    if (normal.full)
+    {
+        auto system = normal.values;
+        for (size_t variable = 0; variable < variable_count; variable++)
+        {
+            system[variable * variable_count + variable] += damping * max(diagonal[variable], diagonal_floor) + diagonal_floor;
+        }
+        return cholesky_solve(system, variable_count, right_hand_side);
+    }
+
+    // The blocks are independent small systems
+    vector<tune_t> system;
+    vector<tune_t> block_solution;
+    for (size_t first = 0; first < variable_count; first += phase_count)
+    {
+        system.assign(normal.values.begin() + first * phase_count, normal.values.begin() + (first + phase_count) * phase_count);
+        block_solution.assign(right_hand_side.begin() + first, right_hand_side.begin() + first + phase_count);
+        for (size_t phase = 0; phase < phase_count; phase++)
+        {
+            system[phase * phase_count + phase] += damping * max(diagonal[first + phase], diagonal_floor) + diagonal_floor;
+        }
+        if (!cholesky_solve(system, phase_count, block_solution))
+        {
+            return false;
+        }
+        copy(block_solution.begin(), block_solution.end(), right_hand_side.begin() + first);
+    }
+    return true;
+}
+
+// Levenberg-Marquardt damped Gauss-Newton. Each iteration solves (normal + damping * diag(normal)) * step = -gradient
+// and only takes the step if it lowers the error, otherwise the damping grows and the system is solved again
+class GaussNewtonOptimizer : public Optimizer
+{
+public:
+    tune_t step(Objective& objective, parameters_t& parameters) override
+    {
+        constexpr int32_t max_attempts = 10;
+        constexpr tune_t damping_decrease = 3;
+        constexpr tune_t damping_increase = 4;
+        constexpr tune_t min_damping = 1e-7;
+
+        const auto variable_count = parameters.size() * phase_count;
+        const auto error = objective.evaluate_normal(parameters, gradient_parameters, normal);
+        const auto gradient = get_variables(gradient_parameters);
+
+        vector<tune_t> start;
+        copy_variables(parameters, start);
+        const auto variables = get_variables(parameters);
+        vector<tune_t> solution;
+        for (int32_t attempt = 0; attempt < max_attempts; attempt++)
+        {
+            solution.assign(gradient, gradient + variable_count);
+            for (auto& value : solution)
+            {
+                value = -value;
+            }
+
+            if (solve_normal_equations(normal, damping, solution))
+            {
+                for (size_t variable = 0; variable < variable_count; variable++)
+                {
+                    variables[variable] = start[variable] + solution[variable];
+                }
+
+                if (objective.evaluate(parameters, nullptr) < error)
+                {
+                    damping = max(damping / damping_decrease, min_damping);
+                    return error;
+                }
+            }
+            damping *= damping_increase;
+        }
+
+        copy(start.begin(), start.end(), variables);
+        return error;
+    }
+
+    string get_status() const override
+    {
+        ostringstream status;
+        status << "damping " << damping;
+        return status.str();
+    }
+
+private:
+    NormalMatrix normal;
+    parameters_t gradient_parameters;
+    tune_t damping = 1e-3;
+};
+
+unique_ptr<Optimizer> make_optimizer(const OptimizerType type)
+{
+    switch (type)
+    {
+    case OptimizerType::Lbfgs:
+        return make_unique<LbfgsOptimizer>();
+    case OptimizerType::GaussNewton:
+        return make_unique<GaussNewtonOptimizer>();
+    default:
+        return make_unique<AdamOptimizer>();
+    }
+}
+
+const char* get_optimizer_name(const OptimizerType type)
+{
+    switch (type)
+    {
+    case OptimizerType::Lbfgs:
+        return "L-BFGS";
+    case OptimizerType::GaussNewton:
+        return gauss_newton_full_matrix ? "Gauss-Newton" : "block diagonal Gauss-Newton";
+    default:
+        return "Adam";
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H 1
+
+#include "base.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class OptimizerType
+{
+    Adam,
+    Lbfgs,
+    GaussNewton
+};
+
+// Optimizers see the parameters as one flat vector of variables. When tapered, the midgame and endgame
+// values of parameter i are the variables 2 * i and 2 * i + 1
+#if TAPERED
+constexpr size_t phase_count = 2;
+#else
+constexpr size_t phase_count = 1;
+#endif
+
+inline tune_t* get_variables(parameters_t& parameters)
+{
+    return reinterpret_cast<tune_t*>(parameters.data());
+}
+
+inline const tune_t* get_variables(const parameters_t& parameters)
+{
+    return reinterpret_cast<const tune_t*>(parameters.data());
+}
+
+// Gauss-Newton approximation of the Hessian of the error. Either the full matrix, or only the blocks that
+// couple the phases of each parameter with each other
+struct NormalMatrix
+{
+    bool full = false;
+    size_t variable_count = 0;
+    // Full: variable_count * variable_count values in row major order, of which only the upper triangle is
+    // filled. Blocks: phase_count * phase_count values per parameter
+    std::vector<tune_t> values;
+
+    void reset(size_t variable_count, bool full);
+};
+
+// The error being minimized, the mean squared error of the data set. Gradients are derivatives of it
+class Objective
+{
+public:
+    virtual ~Objective() = default;
+    // Returns the error of parameters and stores its gradient in gradient unless it is null
+    virtual tune_t evaluate(const parameters_t& parameters, parameters_t* gradient) = 0;
+    // Like evaluate, also stores the normal matrix of parameters in normal
+    virtual tune_t evaluate_normal(const parameters_t& parameters, parameters_t& gradient, NormalMatrix& normal) = 0;
+};
+
+// Solves (normal + damping * diag(normal)) * x = right_hand_side in place of right_hand_side, a small floor on
+// the diagonal keeps variables without any coefficient at zero. Returns false if the system is not positive definite
+bool solve_normal_equations(const NormalMatrix& normal, tune_t damping, std::vector<tune_t>& right_hand_side);
+
+class Optimizer
+{
+public:
+    virtual ~Optimizer() = default;
+    // Moves parameters by one iteration and returns the error they had before it
+    virtual tune_t step(Objective& objective, parameters_t& parameters) = 0;
+    // Scales the step size of later iterations. Optimizers that search for their own step size ignore it
+    virtual void scale_step_size(tune_t ratio) {}
+    // Step size or damping of the latest iteration, for progress reports
+    virtual std::string get_status() const = 0;
+};
+
+std::unique_ptr<Optimizer> make_optimizer(OptimizerType type);
+const char* get_optimizer_name(OptimizerType type);
+
+#endif // !OPTIMIZER_H
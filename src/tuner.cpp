@@ -1,111 +1,162 @@
 #include "tuner.h"
 #include "base.h"
 #include "config.h"
+#include "data_cache.h"
+#include "dataset.h"
+#include "entry_file.h"
+#include "fen.h"
+#include "kernels.h"
+#include "line_reader.h"
+#include "optimizer.h"
 #include "threadpool.h"
+#include "worker_team.h"
 #include "external/chess.hpp"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <charconv>
 #include <chrono>
 #include <cmath>
-#include <fstream>
+#include <concepts>
+#include <deque>
+#include <filesystem>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <span>
 #include <sstream>
 #include <stdexcept>
+#include <string_view>
 #include <thread>
-#include <vector>
-#include <sstream>
 #include <valarray>
+#include <vector>
 
 using namespace std;
 using namespace std::chrono;
 using namespace Tuner;
 
-struct WdlMarker
-{
-    string marker;
-    tune_t wdl;
-};
+// Type of the per entry math in the error and gradient passes
+using kernel_real_t = conditional_t<single_precision, float, tune_t>;
 
-struct CoefficientEntry
-{
-    int16_t value;
-    int16_t index;
-};
+// Instruction set of the range kernels the passes use, the benchmark switches it to compare kernels
+static KernelIsa kernel_isa = KernelIsa::Scalar;
 
-struct Entry
+enum class GradientEngine
 {
-    vector<CoefficientEntry> coefficients;
-    tune_t wdl;
-    bool white_to_move;
-    //tune_t initial_eval;
-    tune_t additional_score;
-#if TAPERED
-    int32_t phase;
-    tune_t endgame_scale;
-#endif
+    // Every thread adds the gradients of its entries to its own gradient copy, the copies are summed at the end
+    PositionMajor,
+    // Residuals are computed first and each thread sums the gradient of its own parameters from the transposed coefficients
+    FeatureMajor
 };
 
-static const array<WdlMarker, 6> markers
-{
-    WdlMarker{"1.0", 1},
-    WdlMarker{"0.5", 0.5},
-    WdlMarker{"0.0", 0},
+static GradientEngine gradient_engine = GradientEngine::PositionMajor;
 
-    WdlMarker{"1-0", 1},
-    WdlMarker{"1/2-1/2", 0.5},
-    WdlMarker{"0-1", 0}
-};
+// Size of the residual blocks the feature major engine weights right after the range kernel computes them
+constexpr size_t residual_block_size = 1024;
+
+// Seed of the shuffled entry orders of mini-batch mode and asynchronous SGD, fixed so runs are reproducible
+constexpr uint64_t mini_batch_shuffle_seed = 0x9E3779B97F4A7C15;
+
+// Entries of the qsearch table of every loader thread, a power of two
+constexpr size_t qsearch_table_size = 1 << 16;
+
+// Positions a loader thread parses before it evaluates them together
+constexpr size_t eval_batch_size = 256;
+
+// Ranges per thread the entries are split into when threads take ranges dynamically
+constexpr size_t work_chunks_per_thread = 16;
+
+constexpr int32_t benchmark_epochs = 100;
+// Largest difference between the error a kernel reaches in the benchmark and the error of the double
+// precision scalar reference that is still treated as a match. The single precision sums are compensated,
+// so it holds for any data set size
+constexpr tune_t benchmark_error_tolerance = 1e-5;
 
-static tune_t get_fen_wdl(const string& original_fen, const bool original_white_to_move, const bool white_to_move, const bool side_to_move_wdl)
+// The entries being tuned on, either held in memory or streamed chunk by chunk from an entry file
+struct Dataset
 {
-    tune_t wdl;
-    bool marker_found = false;
-    for (auto& marker : markers)
+    EntrySet entries;
+    // The coefficients of entries by parameter, only built for the feature major gradient engine
+    TransposedEntrySet transposed;
+    // The residuals of the feature major gradient engine by kernel precision, kept between passes so they are only
+    // allocated once
+    kernel_parameters_t<float> float_weighted_residuals;
+    kernel_parameters_t<double> double_weighted_residuals;
+    // Gradient sums of the position major passes, one per thread and kept between passes. Kernels narrower than
+    // tune_t sum each block of entries into the block gradient of their precision first
+    vector<parameters_t> thread_gradients;
+    vector<kernel_parameters_t<float>> float_block_gradients;
+    vector<kernel_parameters_t<double>> double_block_gradients;
+    EntryStream stream;
+    bool streaming = false;
+    // An entry file only used by this run, removed together with the data set
+    string temporary_entry_file;
+
+    ~Dataset()
     {
-        if (original_fen.find(marker.marker) != std::string::npos)
+        if (!temporary_entry_file.empty())
         {
-            if (marker_found)
-            {
-                cout << "WDL marker already found on line " << original_fen << endl;
-                throw std::runtime_error("WDL marker already found");
-            }
-            marker_found = true;
-            wdl = marker.wdl;
+            error_code error;
+            filesystem::remove(temporary_entry_file, error);
         }
     }
 
-    if(!marker_found)
+    uint64_t size() const
+    {
+        return streaming ? stream.size() : entries.size();
+    }
+
+    template<typename Real>
+    kernel_parameters_t<Real>& get_weighted_residuals()
     {
-        stringstream ss(original_fen);
-        while (!ss.eof())
+        if constexpr (is_same_v<Real, float>)
         {
-            string word;
-            ss >> word;
-            if (word.starts_with("0."))
-            {
-                wdl = stod(word);
-                marker_found = true;
-            }
+            return float_weighted_residuals;
+        }
+        else
+        {
+            return double_weighted_residuals;
         }
     }
 
-    if (!marker_found)
+    template<typename Real>
+    vector<kernel_parameters_t<Real>>& get_block_gradients()
     {
-        cout << "WDL marker not found on line " << original_fen << endl;
-        throw std::runtime_error("WDL marker not found");
+        if constexpr (is_same_v<Real, float>)
+        {
+            return float_block_gradients;
+        }
+        else
+        {
+            return double_block_gradients;
+        }
     }
 
-    if(!original_white_to_move && side_to_move_wdl)
+    template<typename F>
+    void for_each_chunk(F&& chunk_handler)
     {
-        wdl = 1 - wdl;
+        if (streaming)
+        {
+            stream.for_each_chunk(chunk_handler);
+        }
+        else
+        {
+            chunk_handler(entries);
+        }
     }
+};
 
-    return wdl;
-}   
-
-static bool get_fen_color_to_move(const string& fen)
+// Threads used for loading and for the passes, thread_count or every hardware thread if it is 0
+static uint32_t get_thread_count()
 {
-    return fen.find('w') != std::string::npos;
+    if constexpr (thread_count > 0)
+    {
+        return thread_count;
+    }
+    return max(thread::hardware_concurrency(), 1u);
 }
 
 static void print_elapsed(high_resolution_clock::time_point start)
@@ -116,125 +167,164 @@ static void print_elapsed(high_resolution_clock::time_point start)
     cout << "[" << elapsed_seconds << "s] ";
 }
 
-static void get_coefficient_entries(const coefficients_t& coefficients, vector<CoefficientEntry>& coefficient_entries, int32_t parameter_count)
+// Evals that write their coefficients straight into sparse rows provide these, the dense calls are the fallback
+template<typename Eval>
+concept SparseFenEval = requires(const string& fen, SparseEvalResult& result)
 {
-    if(coefficients.size() != parameter_count)
-    {
-        throw runtime_error("Parameter count mismatch");
-    }
+    Eval::get_fen_sparse_eval_result(fen, result);
+};
+
+template<typename Eval>
+concept SparseExternalEval = requires(const Chess::Board& board, SparseEvalResult& result)
+{
+    Eval::get_external_sparse_eval_result(board, result);
+};
+
+// Evals that set up their position from the parsed FEN the loader already has provide this
+template<typename Eval>
+concept ParsedFenEval = requires(const ParsedFen& fen, SparseEvalResult& result)
+{
+    Eval::get_parsed_sparse_eval_result(fen, result);
+};
+
+// Evals that evaluate a whole batch of parsed positions at once into sparse rows provide this, the fallback is a
+// get_parsed_eval_result call per position
+template<typename Eval>
+concept BatchEval = requires(span<const ParsedFen> fens, SparseEvalBatch& results)
+{
+    Eval::get_parsed_sparse_eval_results(fens, results);
+};
+
+// Evals that can score a position against the parameters without tracing it provide these, with the same value as
+// the dot product of its coefficients with them. The qsearch then skips the trace of every node
+template<typename Eval>
+concept ScoreEval = requires(const string& fen, const Chess::Board& board, const parameters_t& parameters)
+{
+    { Eval::get_fen_score(fen, parameters) } -> convertible_to<tune_t>;
+    { Eval::get_external_score(board, parameters) } -> convertible_to<tune_t>;
+};
 
-    for (int16_t i = 0; i < coefficients.size(); i++)
+// Evals that print their parameters after moving values between them provide this, so the rounded parameters are
+// compared as printed
+template<typename Eval>
+concept RebalancedEval = requires(parameters_t& parameters)
+{
+    Eval::rebalance_parameters(parameters);
+};
+
+static void get_sparse_eval_result(const EvalResult& eval_result, SparseEvalResult& result)
+{
+    result.coefficients.clear();
+    for (int32_t i = 0; i < static_cast<int32_t>(eval_result.coefficients.size()); i++)
     {
-        if (coefficients[i] == 0)
+        if (eval_result.coefficients[i] != 0)
         {
-            continue;
+            result.coefficients.push_back({eval_result.coefficients[i], static_cast<int16_t>(i)});
         }
-
-        const auto coefficient_entry = CoefficientEntry{coefficients[i], i};
-        coefficient_entries.push_back(coefficient_entry);
     }
+    result.score = eval_result.score;
+    result.endgame_scale = eval_result.endgame_scale;
 }
 
-static tune_t linear_eval(const Entry& entry, const parameters_t& parameters)
+static void get_fen_eval_result(const string& fen, SparseEvalResult& result)
 {
-    tune_t score = entry.additional_score;
-#if TAPERED 
-    tune_t midgame = 0;
-    tune_t endgame = 0;
-    for (const auto& coefficient : entry.coefficients)
+    if constexpr (SparseFenEval<TuneEval>)
     {
-        midgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Midgame)];
-        endgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Endgame)] * entry.endgame_scale;
+        TuneEval::get_fen_sparse_eval_result(fen, result);
     }
-    score += (midgame * entry.phase + endgame * (24 - entry.phase)) / 24;
-#else
-    for (const auto& coefficient : entry.coefficients)
+    else
     {
-        score += coefficient.value * parameters[coefficient.index];
+        get_sparse_eval_result(TuneEval::get_fen_eval_result(fen), result);
     }
-#endif
+}
 
-    return score;
+// fen_buffer holds the FEN for evals that take it as a string
+static void get_parsed_eval_result(const ParsedFen& fen, string& fen_buffer, SparseEvalResult& result)
+{
+    if constexpr (ParsedFenEval<TuneEval>)
+    {
+        TuneEval::get_parsed_sparse_eval_result(fen, result);
+    }
+    else
+    {
+        fen_buffer.assign(fen.fen);
+        get_fen_eval_result(fen_buffer, result);
+    }
 }
 
-static int32_t get_phase(const string& fen)
+// Replaces results with a row for every position of fens, in the same order
+static void get_parsed_eval_results(const span<const ParsedFen> fens, SparseEvalBatch& results)
 {
-    int32_t phase = 0;
-    auto stop = false;
-    for(const char ch : fen)
+    if constexpr (BatchEval<TuneEval>)
+    {
+        TuneEval::get_parsed_sparse_eval_results(fens, results);
+    }
+    else
     {
-        if(stop)
+        thread_local string fen_buffer;
+        thread_local SparseEvalResult result;
+        results.clear();
+        for (const auto& fen : fens)
         {
-            break;
+            get_parsed_eval_result(fen, fen_buffer, result);
+            results.add_row(result);
         }
+    }
+}
 
-        switch (ch)
-        {
-        case 'n':
-        case 'N':
-            phase += 1;
-            break;
-        case 'b':
-        case 'B':
-            phase += 1;
-            break;
-        case 'r':
-        case 'R':
-            phase += 2;
-            break;
-        case 'q':
-        case 'Q':
-            phase += 4;
-            break;
-        case 'p':
-        case '/':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-            break;
-        case ' ':
-            stop = true;
-            break;
-        }
+static void get_external_eval_result(const Chess::Board& board, SparseEvalResult& result)
+{
+    if constexpr (SparseExternalEval<TuneEval>)
+    {
+        TuneEval::get_external_sparse_eval_result(board, result);
+    }
+    else
+    {
+        get_sparse_eval_result(TuneEval::get_external_eval_result(board), result);
     }
-    return phase;
 }
 
-static int32_t get_phase(const Chess::Board& board)
+static void encode_coefficients(const span<const CoefficientEntry> coefficients, entry_buffer_t<uint8_t>& encoded_coefficients, int32_t parameter_count)
 {
-    int32_t phase = 0;
+    if (!coefficients.empty() && coefficients.back().index >= parameter_count)
+    {
+        throw runtime_error("Parameter count mismatch");
+    }
 
-    for(Chess::Square square = static_cast<Chess::Square>(0); square < 64; ++square)
+    int32_t previous_index = -1;
+    for (const auto& coefficient : coefficients)
     {
-        auto piece = board.pieceAt(square);
-        switch (piece)
-        {
-        case Chess::Piece::WHITEKNIGHT:
-        case Chess::Piece::WHITEBISHOP:
-        case Chess::Piece::BLACKKNIGHT:
-        case Chess::Piece::BLACKBISHOP:
-            phase += 1;
-            break;
-        case Chess::Piece::WHITEROOK:
-        case Chess::Piece::BLACKROOK:
-            phase += 2;
-            break;
-        case Chess::Piece::WHITEQUEEN:
-        case Chess::Piece::BLACKQUEEN:
-            phase += 4;
-            break;
-        }
+        encode_coefficient(encoded_coefficients, coefficient.value, static_cast<uint32_t>(coefficient.index - previous_index - 1));
+        previous_index = coefficient.index;
     }
+}
+
+// Appends an entry for an evaluated position, its additional score is left at 0
+static void add_entry(EntrySet& entries, const span<const CoefficientEntry> coefficients, const tune_t endgame_scale, const tune_t wdl, const bool white_to_move, const int32_t phase, const int32_t parameter_count)
+{
+    encode_coefficients(coefficients, entries.coefficients, parameter_count);
+    entries.offsets.push_back(entries.coefficients.size());
+#if TAPERED
+    entries.headers.push_back(make_entry_header(wdl, white_to_move, phase, endgame_scale));
+#else
+    entries.headers.push_back(make_entry_header(wdl, white_to_move, phase, 1));
+#endif
+}
 
+static int32_t get_phase(const Chess::Board& board)
+{
+    int32_t phase = 0;
+    for (const auto color : {Chess::Color::WHITE, Chess::Color::BLACK})
+    {
+        phase += popcount(board.pieces(Chess::PieceType::KNIGHT, color));
+        phase += popcount(board.pieces(Chess::PieceType::BISHOP, color));
+        phase += 2 * popcount(board.pieces(Chess::PieceType::ROOK, color));
+        phase += 4 * popcount(board.pieces(Chess::PieceType::QUEEN, color));
+    }
     return phase;
 }
 
-static void print_statistics(const parameters_t& parameters, const vector<Entry>& entries)
+static void print_statistics(const parameters_t& parameters, Dataset& dataset)
 {
     array<size_t, 2> wins{};
     array<size_t, 2> draws{};
@@ -242,33 +332,40 @@ static void print_statistics(const parameters_t& parameters, const vector<Entry>
     array<size_t, 2> total{};
     array<tune_t, 2> wdls{};
 
-    for(auto& entry : entries)
+    dataset.for_each_chunk([&](const EntrySet& entries)
     {
-        if(entry.wdl == 1)
-        {
-            wins[entry.white_to_move]++;
-        }
-        else if(entry.wdl == 0.5)
-        {
-            draws[entry.white_to_move]++;
-        }
-        else if (entry.wdl == 0.0)
+        for(size_t entry_index = 0; entry_index < entries.size(); entry_index++)
         {
-            losses[entry.white_to_move]++;
+            const auto& header = entries.headers[entry_index];
+            const auto wdl = header.get_wdl();
+            const auto white_to_move = header.white_to_move;
+            if(wdl == 1)
+            {
+                wins[white_to_move]++;
+            }
+            else if(wdl == 0.5)
+            {
+                draws[white_to_move]++;
+            }
+            else if (wdl == 0.0)
+            {
+                losses[white_to_move]++;
+            }
+            total[white_to_move]++;
+            wdls[white_to_move] += wdl;
         }
-        total[entry.white_to_move]++;
-        wdls[entry.white_to_move] += entry.wdl;
-    }
+    });
 
+    const auto entry_count = dataset.size();
     cout << "Dataset statistics:" << endl;
-    cout << "Total positions: " << entries.size() << endl;
+    cout << "Total positions: " << entry_count << endl;
     for(int color = 1; color >= 0; color--)
     {
         const auto color_name = color ? "White" : "Black";
-        cout << color_name << ": " << total[color] << " (" << (total[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 1.0: " << wins[color] << " (" << (wins[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 0.5: " << draws[color] << " (" << (draws[color] * 100.0 / entries.size()) << "%)" << endl;
-        cout << color_name << " 0.0: " << losses[color] << " (" << (losses[color] * 100.0 / entries.size()) << "%)" << endl;
+        cout << color_name << ": " << total[color] << " (" << (total[color] * 100.0 / entry_count) << "%)" << endl;
+        cout << color_name << " 1.0: " << wins[color] << " (" << (wins[color] * 100.0 / entry_count) << "%)" << endl;
+        cout << color_name << " 0.5: " << draws[color] << " (" << (draws[color] * 100.0 / entry_count) << "%)" << endl;
+        cout << color_name << " 0.0: " << losses[color] << " (" << (losses[color] * 100.0 / entry_count) << "%)" << endl;
         cout << color_name << " avg: " << wdls[color] / total[color] << endl;
     }
 
@@ -276,12 +373,9 @@ static void print_statistics(const parameters_t& parameters, const vector<Entry>
 }
 
 constexpr tune_t inf = 1 << 20;
-struct PvEntry
-{
-    array<Chess::Move, 64> moves{};
-    int32_t length = 0;
-};
-using pv_table_t = array<PvEntry, 64>;
+
+// Longest principal variation followed from the root to the resolved position
+constexpr int32_t max_pv_length = 64;
 
 static int32_t get_piece_value(const Chess::Piece piece)
 {
@@ -332,368 +426,1786 @@ static int32_t mvv_lva(const Chess::Board& board, const Chess::Move move)
     return score;
 }
 
-static tune_t quiescence(Chess::Board& board, const parameters_t& parameters, pv_table_t& pv_table, tune_t alpha, tune_t beta, const int32_t ply)
+// Dot product of the sparse coefficients of a position with the parameters, tapered like an entry
+static tune_t get_sparse_eval(const SparseEvalResult& eval_result, const int32_t phase, const parameters_t& parameters)
 {
-    pv_table[ply].length = 0;
-
-    EvalResult eval_result;
-    if constexpr (TuneEval::supports_external_chess_eval)
+#if TAPERED
+    tune_t midgame = 0;
+    tune_t endgame = 0;
+    for (const auto& coefficient : eval_result.coefficients)
     {
-        eval_result = TuneEval::get_external_eval_result(board);
+        midgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Midgame)];
+        endgame += coefficient.value * parameters[coefficient.index][static_cast<int32_t>(PhaseStages::Endgame)];
     }
-    else
+    const auto header = make_entry_header(0, true, phase, eval_result.endgame_scale);
+    return midgame * header.midgame_weight + endgame * header.endgame_weight;
+#else
+    tune_t score = 0;
+    for (const auto& coefficient : eval_result.coefficients)
     {
-        auto fen = board.getFen();
-        eval_result = TuneEval::get_fen_eval_result(fen);
+        score += coefficient.value * parameters[coefficient.index];
     }
-
-    Entry entry;
-    entry.white_to_move = board.sideToMove() == Chess::Color::WHITE;
-#if TAPERED
-    entry.endgame_scale = eval_result.endgame_scale;
-#endif
-    get_coefficient_entries(eval_result.coefficients, entry.coefficients, static_cast<int32_t>(parameters.size()));
-#if TAPERED
-    entry.phase = get_phase(board);
+    return score;
 #endif
-    entry.additional_score = 0;
-    tune_t eval = linear_eval(entry, parameters);
-    if(!entry.white_to_move)
+}
+
+// A Chess::Board set up from a parsed FEN and read back into one, without going through FEN strings. Kept per
+// thread, so the move history it holds is only allocated once
+class QsearchBoard : public Chess::Board
+{
+public:
+    void set_board(const ParsedFen& fen)
     {
-        eval = -eval;
+        // The parsed piece numbering is the Chess::Piece one, white pieces first
+        for (int32_t piece = 0; piece < fen_piece_count; piece++)
+        {
+            pieces_bb_[piece / 6][piece % 6] = fen.pieces[piece];
+        }
+        for (int32_t square = 0; square < 64; square++)
+        {
+            board_[square] = fen.board[square] == fen_empty_square ? Chess::Piece::NONE : static_cast<Chess::Piece>(fen.board[square]);
+        }
+
+        side_to_move_ = fen.white_to_move ? Chess::Color::WHITE : Chess::Color::BLACK;
+        castling_rights_.clearAllCastlingRights();
+        if (fen.castling & 1)
+        {
+            castling_rights_.setCastlingRight<Chess::Color::WHITE, Chess::CastleSide::KING_SIDE, Chess::File::FILE_H>();
+        }
+        if (fen.castling & 2)
+        {
+            castling_rights_.setCastlingRight<Chess::Color::WHITE, Chess::CastleSide::QUEEN_SIDE, Chess::File::FILE_A>();
+        }
+        if (fen.castling & 4)
+        {
+            castling_rights_.setCastlingRight<Chess::Color::BLACK, Chess::CastleSide::KING_SIDE, Chess::File::FILE_H>();
+        }
+        if (fen.castling & 8)
+        {
+            castling_rights_.setCastlingRight<Chess::Color::BLACK, Chess::CastleSide::QUEEN_SIDE, Chess::File::FILE_A>();
+        }
+        enpassant_square_ = fen.en_passant_square == fen_no_square ? Chess::NO_SQ : static_cast<Chess::Square>(fen.en_passant_square);
+        half_moves_ = static_cast<uint8_t>(fen.half_move_clock);
+        full_moves_ = 2;
+
+        occ_all_ = all();
+        zobristHash();
+        prev_states_.clear();
     }
 
-    if (eval >= beta)
+    // Chess::Board::makeMove takes the pawn an en passant capture removes out of the hash key twice, which leaves
+    // it in, so it is taken out once more
+    void make_move(const Chess::Move move)
     {
-        return eval;
+        makeMove(move);
+        if (move.typeOf() == Chess::Move::EN_PASSANT)
+        {
+            updateKeyPiece(Chess::makePiece(side_to_move_, Chess::PieceType::PAWN), static_cast<Chess::Square>(move.to() ^ 8));
+        }
     }
 
-    if (eval > alpha)
+    // Chess::Board::unmakeMove only takes the pieces back out of the hash key, the key from before the move is
+    // restored here as a whole
+    void unmake_move(const Chess::Move move)
     {
-        alpha = eval;
+        const auto key = prev_states_.back().hash;
+        unmakeMove(move);
+        hash_key_ = key;
     }
 
-    Chess::Movelist<Chess::Move> moves;
-    Chess::Movegen::legalmoves<Chess::Move, Chess::MoveGenType::CAPTURE>(moves, board);
-    array<int32_t, 64> move_scores;
-    for (int32_t move_index = 0; move_index < moves.size(); move_index++)
+
+    // Writes the position into the board fields of fen, the line fields are left as they are
+    void get_parsed_fen(ParsedFen& fen) const
     {
-        move_scores[move_index] = mvv_lva(board, moves[move_index]);
+        for (int32_t piece = 0; piece < fen_piece_count; piece++)
+        {
+            fen.pieces[piece] = pieces_bb_[piece / 6][piece % 6];
+        }
+        for (int32_t square = 0; square < 64; square++)
+        {
+            fen.board[square] = board_[square] == Chess::Piece::NONE ? fen_empty_square : static_cast<uint8_t>(board_[square]);
+        }
+
+        fen.white_to_move = side_to_move_ == Chess::Color::WHITE;
+        fen.castling = 0;
+        fen.castling |= castling_rights_.hasCastlingRight(Chess::Color::WHITE, Chess::CastleSide::KING_SIDE) ? 1 : 0;
+        fen.castling |= castling_rights_.hasCastlingRight(Chess::Color::WHITE, Chess::CastleSide::QUEEN_SIDE) ? 2 : 0;
+        fen.castling |= castling_rights_.hasCastlingRight(Chess::Color::BLACK, Chess::CastleSide::KING_SIDE) ? 4 : 0;
+        fen.castling |= castling_rights_.hasCastlingRight(Chess::Color::BLACK, Chess::CastleSide::QUEEN_SIDE) ? 8 : 0;
+        fen.en_passant_square = enpassant_square_ == Chess::NO_SQ ? fen_no_square : static_cast<uint8_t>(enpassant_square_);
+        fen.half_move_clock = half_moves_;
+        fen.phase = get_phase(*this);
     }
+};
+
+// Results of qsearch nodes by Zobrist key, in buckets of a few entries. Exact results keep the move that led to
+// them, so the principal variation can be followed through the table instead of being copied up the search. A
+// new result replaces an entry of an earlier search first, which keeps the variation of the current one intact
+class QsearchTable
+{
+public:
+    enum class Bound : uint8_t
+    {
+        None,
+        Exact,
+        // The score is at least, or at most, the stored one
+        Lower,
+        Upper
+    };
+
+    struct Entry
+    {
+        uint64_t key;
+        tune_t score;
+        Chess::Move move;
+        Bound bound;
+        uint8_t generation;
+    };
 
-    if(moves.size() == 0)
+    QsearchTable() : entries(qsearch_table_size) {}
+
+    // Called before every search, the entries stored from then on belong to it
+    void new_search()
     {
-        return alpha;
+        generation++;
     }
 
-    tune_t best_score = -inf;
-    auto best_move = Chess::Move(Chess::Move::NO_MOVE);
-    //for (const auto& move : movelist) {
-    for(int32_t move_index = 0; move_index < moves.size(); move_index++)
+    // Returns the entry of key, or nullptr if its bucket does not hold it
+    const Entry* probe(const uint64_t key) const
     {
-        int32_t best_move_score = 0;
-        int32_t best_move_index = 0;
-        for(auto i = move_index; i < moves.size(); i++)
+        const auto bucket = get_bucket(key);
+        for (size_t i = 0; i < bucket_size; i++)
         {
-            if(move_scores[i] > best_move_score)
+            if (bucket[i].bound != Bound::None && bucket[i].key == key)
             {
-                best_move_score = move_scores[i];
-                best_move_index = i;
+                return &bucket[i];
             }
         }
+        return nullptr;
+    }
 
-        const auto move = moves[best_move_index];
-        moves[best_move_index] = moves[move_index];
-        move_scores[best_move_index] = move_scores[move_index];
-
-        board.makeMove(move);
-
-        const auto child_score = -quiescence(board, parameters, pv_table, -beta, -alpha, ply + 1);
-        if(child_score > best_score)
+    void store(const uint64_t key, const tune_t score, const Chess::Move move, const Bound bound)
+    {
+        const auto bucket = get_bucket(key);
+        auto replaced = bucket;
+        for (size_t i = 0; i < bucket_size; i++)
         {
-            best_score = child_score;
-            best_move = move;
-            if (child_score > alpha)
+            if (bucket[i].bound != Bound::None && bucket[i].key == key)
             {
-                alpha = child_score;
-                if(child_score >= beta)
+                // An exact result is kept over a bound, which another path to the position with a narrower
+                // window can store later
+                if (bucket[i].bound == Bound::Exact && bound != Bound::Exact)
                 {
-                    board.unmakeMove(move);
-                    break;
+                    return;
                 }
+                replaced = &bucket[i];
+                break;
+            }
 
-                auto& this_ply = pv_table[ply];
-                auto& next_ply = pv_table[ply + 1];
-                this_ply.moves[0] = move;
-                this_ply.length = next_ply.length + 1;
-                for (int32_t nextPlyIndex = 0; nextPlyIndex < next_ply.length; nextPlyIndex++)
-                {
-                    this_ply.moves[nextPlyIndex + 1] = next_ply.moves[nextPlyIndex];
-                }
+            if (get_priority(bucket[i]) < get_priority(*replaced))
+            {
+                replaced = &bucket[i];
             }
         }
-
-        board.unmakeMove(move);
+        *replaced = Entry{key, score, move, bound, generation};
     }
 
-    return best_score;
-}
+private:
+    static constexpr size_t bucket_size = 4;
 
-string quiescence_root(const parameters_t& parameters, const string& initial_fen)
-{
-    pv_table_t pv_table {};
-    int space_count = 0;
-    size_t pos = 0;
-    for (size_t i = 0; i < initial_fen.size(); ++i) {
-        if (initial_fen[i] == ' ') {
-            ++space_count;
-        }
-        if (space_count == 4) {
-            pos = i;
-            break;
-        }
+    Entry* get_bucket(const uint64_t key)
+    {
+        return entries.data() + (key & (qsearch_table_size / bucket_size - 1)) * bucket_size;
     }
-    const auto clean_fen = initial_fen.substr(0, pos);
 
-    auto board = Chess::Board(clean_fen);
-    auto score = quiescence(board, parameters, pv_table, -inf, inf, 0);
-    if(board.sideToMove() == Chess::Color::BLACK)
+    const Entry* get_bucket(const uint64_t key) const
     {
-        score = -score;
+        return entries.data() + (key & (qsearch_table_size / bucket_size - 1)) * bucket_size;
     }
-    if constexpr (print_data_entries)
+
+    // Empty entries go first, then those of earlier searches, bounds before exact results
+    int32_t get_priority(const Entry& entry) const
     {
-        if (pv_table[0].length > 0)
+        if (entry.bound == Bound::None)
         {
-            cout << " PV:";
-            for (int32_t pv_index = 0; pv_index < pv_table[0].length; pv_index++)
-            {
-                cout << " " << pv_table[0].moves[pv_index];
-            }
+            return -1;
         }
-        cout << " QS: " << score;
+        return (entry.generation == generation ? 2 : 0) + (entry.bound == Bound::Exact ? 1 : 0);
     }
 
-    for (int32_t pv_index = 0; pv_index < pv_table[0].length; pv_index++)
-    {
-        board.makeMove(pv_table[0].moves[pv_index]);
-    }
-
-    auto result_fen = board.getFen();
-    return result_fen;
-}
+    vector<Entry> entries;
+    uint8_t generation = 0;
+};
 
-static void load_fen(const DataSource& source, const parameters_t& parameters, const high_resolution_clock::time_point start, vector<Entry>& entries, const string& original_fen)
+// Resolves data positions to the end of their capture sequences. There is one per loader thread and it is reused
+// for every line the thread loads, with no allocations once its buffers have grown. The table stays valid across
+// lines because the parameters do not change while loading, and lines of the same game, which usually come one
+// after another in a data file, share most of their capture sequences
+class QuiescenceResolver
 {
-    if constexpr (print_data_entries)
+public:
+    // Replaces the board fields of fen with the position at the end of its principal variation. Returns whether it
+    // moved away from the position of the line
+    bool resolve(const parameters_t& parameters, ParsedFen& fen)
     {
-        //cout << fen;
-    }
+        this->parameters = &parameters;
+        table.new_search();
+        board.set_board(fen);
+        auto score = quiescence(-inf, inf);
+        if (board.sideToMove() == Chess::Color::BLACK)
+        {
+            score = -score;
+        }
 
-    string fen;
-    if constexpr (enable_qsearch)
-    {
-        fen = quiescence_root(parameters, original_fen);
-    }
-    else
-    {
-        fen = original_fen;
-    }
+        int32_t pv_length = 0;
+        for (; pv_length < max_pv_length; pv_length++)
+        {
+            const auto entry = table.probe(board.hash());
+            if (entry == nullptr || entry->bound != QsearchTable::Bound::Exact || entry->move == Chess::Move::NO_MOVE)
+            {
+                break;
+            }
 
-    const auto eval_result = TuneEval::get_fen_eval_result(fen);
+            if constexpr (print_data_entries)
+            {
+                cout << (pv_length == 0 ? " PV: " : " ") << entry->move;
+            }
+            board.make_move(entry->move);
+        }
 
-    Entry entry;
-    entry.white_to_move = get_fen_color_to_move(fen);
-#if TAPERED
-    entry.endgame_scale = eval_result.endgame_scale;
-#endif
-    const bool original_white_to_move = get_fen_color_to_move(original_fen);
-    //cout << (entry.white_to_move ? "w" : "b") << " ";
-    entry.wdl = get_fen_wdl(original_fen, original_white_to_move, entry.white_to_move, source.side_to_move_wdl);
-    get_coefficient_entries(eval_result.coefficients, entry.coefficients, static_cast<int32_t>(parameters.size()));
-#if TAPERED
-    entry.phase = get_phase(fen);
-#endif
-    entry.additional_score = 0;
-    if constexpr (TuneEval::includes_additional_score)
-    {
-        const tune_t score = linear_eval(entry, parameters);
         if constexpr (print_data_entries)
         {
-            cout << " Eval: " << score << endl;
+            cout << " QS: " << score;
         }
-        entry.additional_score = eval_result.score - score;
-    }
 
-    entries.push_back(entry);
-}
+        if (pv_length == 0)
+        {
+            return false;
+        }
+        board.get_parsed_fen(fen);
+        return true;
+    }
 
-static void load_fens(const DataSource& source, const parameters_t& parameters, const high_resolution_clock::time_point start, vector<Entry>& entries)
-{
-    cout << "Loading " << source.path;
-    if(source.position_limit > 0)
+    // FEN of the position the last resolve ended on
+    string get_fen() const
     {
-        cout << " (" << source.position_limit << " positions)";
+        return board.getFen();
     }
-    cout << "..." << endl;
 
-    ifstream file(source.path);
-    if(!file)
+private:
+    // White's eval of a qsearch node, the same tapered linear eval of the parameters the passes tune
+    tune_t get_node_eval()
     {
-        cout << "Failed to open " << source.path << endl;
-        throw runtime_error("Failed to open data source");
+        if constexpr (ScoreEval<TuneEval>)
+        {
+            if constexpr (TuneEval::supports_external_chess_eval)
+            {
+                return TuneEval::get_external_score(board, *parameters);
+            }
+            else
+            {
+                return TuneEval::get_fen_score(board.getFen(), *parameters);
+            }
+        }
+        else
+        {
+            if constexpr (TuneEval::supports_external_chess_eval)
+            {
+                get_external_eval_result(board, eval_result);
+            }
+            else if constexpr (ParsedFenEval<TuneEval>)
+            {
+                board.get_parsed_fen(node_fen);
+                TuneEval::get_parsed_sparse_eval_result(node_fen, eval_result);
+            }
+            else
+            {
+                get_fen_eval_result(board.getFen(), eval_result);
+            }
+            return get_sparse_eval(eval_result, get_phase(board), *parameters);
+        }
     }
 
-    int64_t position_count = 0;
-    while (!file.eof())
+    tune_t quiescence(tune_t alpha, const tune_t beta)
     {
-        if (source.position_limit > 0 && position_count >= source.position_limit)
+        const auto key = board.hash();
+        if (const auto entry = table.probe(key))
         {
-            break;
+            if (entry->bound == QsearchTable::Bound::Exact
+                || (entry->bound == QsearchTable::Bound::Lower && entry->score >= beta)
+                || (entry->bound == QsearchTable::Bound::Upper && entry->score <= alpha))
+            {
+                return entry->score;
+            }
         }
 
-        string original_fen;
-        getline(file, original_fen);
-        if (original_fen.empty())
+        tune_t eval = get_node_eval();
+        if (board.sideToMove() != Chess::Color::WHITE)
         {
-            break;
+            eval = -eval;
         }
 
-        load_fen(source, parameters, start, entries, original_fen);
-
-        position_count++;
-        if (position_count % data_load_print_interval == 0)
+        if (eval >= beta)
         {
+            table.store(key, eval, Chess::Move(Chess::Move::NO_MOVE), QsearchTable::Bound::Lower);
+            return eval;
+        }
+
+        const auto original_alpha = alpha;
+        if (eval > alpha)
+        {
+            alpha = eval;
+        }
+
+        Chess::Movelist<Chess::Move> moves;
+        Chess::Movegen::legalmoves<Chess::Move, Chess::MoveGenType::CAPTURE>(moves, board);
+        array<int32_t, 256> move_scores;
+        for (int32_t move_index = 0; move_index < moves.size(); move_index++)
+        {
+            move_scores[move_index] = mvv_lva(board, moves[move_index]);
+        }
+
+        // Standing pat is always an option, so the score never drops below the eval
+        tune_t best_score = eval;
+        auto best_move = Chess::Move(Chess::Move::NO_MOVE);
+        for (int32_t move_index = 0; move_index < moves.size(); move_index++)
+        {
+            auto best_move_index = move_index;
+            for (auto i = move_index + 1; i < moves.size(); i++)
+            {
+                if (move_scores[i] > move_scores[best_move_index])
+                {
+                    best_move_index = i;
+                }
+            }
+
+            const auto move = moves[best_move_index];
+            moves[best_move_index] = moves[move_index];
+            move_scores[best_move_index] = move_scores[move_index];
+
+            board.make_move(move);
+            const auto child_score = -quiescence(-beta, -alpha);
+            board.unmake_move(move);
+
+            if (child_score > best_score)
+            {
+                best_score = child_score;
+                if (child_score > alpha)
+                {
+                    best_move = move;
+                    alpha = child_score;
+                    if (child_score >= beta)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        const auto bound = best_score >= beta ? QsearchTable::Bound::Lower
+            : best_score > original_alpha ? QsearchTable::Bound::Exact
+            : QsearchTable::Bound::Upper;
+        table.store(key, best_score, best_move, bound);
+        return best_score;
+    }
+
+    QsearchBoard board;
+    QsearchTable table;
+    const parameters_t* parameters = nullptr;
+    // Buffers of the evaluations that trace their nodes, each node is done with them before it recurses
+    SparseEvalResult eval_result;
+    ParsedFen node_fen;
+};
+
+// Positions of a shard that are parsed but not evaluated yet. Buffers are kept between batches, so a loader thread
+// stops allocating once they have grown
+struct LoadBatch
+{
+    vector<ParsedFen> fens;
+    vector<tune_t> wdls;
+    // With qsearch, the FEN of every slot the qsearch moved to another position, for evals that take a string.
+    // The parsed position of the slot points into it
+    vector<string> resolved_fens = vector<string>(enable_qsearch ? eval_batch_size : 0);
+    SparseEvalBatch results;
+};
+
+static void parse_line(const DataSource& source, const parameters_t& parameters, const string_view original_fen, LoadBatch& batch)
+{
+    if constexpr (print_data_entries)
+    {
+        //cout << fen;
+    }
+
+    auto& parsed_fen = batch.fens.emplace_back();
+    if (!parse_fen(original_fen, parsed_fen))
+    {
+        cout << "Invalid FEN on line " << original_fen << endl;
+        throw std::runtime_error("Invalid FEN");
+    }
+
+    if (parsed_fen.result_marker_count == 0)
+    {
+        cout << "WDL marker not found on line " << original_fen << endl;
+        throw std::runtime_error("WDL marker not found");
+    }
+
+    if (parsed_fen.result_marker_count > 1)
+    {
+        cout << "WDL marker already found on line " << original_fen << endl;
+        throw std::runtime_error("WDL marker already found");
+    }
+
+    auto wdl = parsed_fen.result;
+    if (!parsed_fen.white_to_move && source.side_to_move_wdl)
+    {
+        wdl = 1 - wdl;
+    }
+    batch.wdls.push_back(wdl);
+
+    if constexpr (enable_qsearch)
+    {
+        thread_local QuiescenceResolver resolver;
+        if (resolver.resolve(parameters, parsed_fen))
+        {
+            // Only evals that take the position as a string need the FEN of the resolved one
+            parsed_fen.fen = {};
+            if constexpr (!ParsedFenEval<TuneEval> && !BatchEval<TuneEval>)
+            {
+                auto& resolved_fen = batch.resolved_fens[batch.fens.size() - 1];
+                resolved_fen = resolver.get_fen();
+                parsed_fen.fen = resolved_fen;
+            }
+        }
+    }
+}
+
+// Evaluates the positions of the batch, appends their entries and empties the batch
+static void evaluate_batch(const parameters_t& parameters, LoadBatch& batch, EntrySet& entries)
+{
+    get_parsed_eval_results(batch.fens, batch.results);
+    for (size_t row = 0; row < batch.fens.size(); row++)
+    {
+        const auto& parsed_fen = batch.fens[row];
+        add_entry(entries, batch.results.get_row(row), batch.results.endgame_scales[row], batch.wdls[row], parsed_fen.white_to_move, parsed_fen.phase, static_cast<int32_t>(parameters.size()));
+        if constexpr (TuneEval::includes_additional_score)
+        {
+            const auto entry_index = entries.size() - 1;
+            const tune_t score = linear_eval(entries, entry_index, parameters);
+            if constexpr (print_data_entries)
+            {
+                cout << " Eval: " << score << endl;
+            }
+            entries.headers[entry_index].additional_score = batch.results.scores[row] - score;
+        }
+    }
+
+    batch.fens.clear();
+    batch.wdls.clear();
+}
+
+struct LoadShard
+{
+    string_view lines;
+    EntrySet entries;
+    exception_ptr error;
+};
+
+// Cuts a block after the given number of non-empty lines and subtracts them from the budget
+static string_view take_lines(const string_view block, int64_t& line_budget)
+{
+    size_t offset = 0;
+    while (offset < block.size() && line_budget > 0)
+    {
+        const auto line_end = block.find('\n', offset);
+        const auto next_offset = line_end == string_view::npos ? block.size() : line_end + 1;
+        if (!trim_line_end(block.substr(offset, line_end - offset)).empty())
+        {
+            line_budget--;
+        }
+        offset = next_offset;
+    }
+
+    return block.substr(0, offset);
+}
+
+// Splits a block of lines into shards of roughly equal size, each ending on a line boundary
+static void split_into_shards(string_view block, const size_t shard_count, vector<LoadShard>& shards)
+{
+    const auto target_size = block.size() / shard_count + 1;
+    while (!block.empty())
+    {
+        const auto line_end = block.find('\n', min(target_size, block.size()) - 1);
+        const auto shard_size = line_end == string_view::npos ? block.size() : line_end + 1;
+        shards.push_back(LoadShard{block.substr(0, shard_size), {}, nullptr});
+        block.remove_prefix(shard_size);
+    }
+}
+
+static void load_shard(const DataSource& source, const parameters_t& parameters, const high_resolution_clock::time_point start, LoadShard& shard, atomic<int64_t>& position_count, mutex& print_mutex)
+{
+    LoadBatch batch;
+    batch.fens.reserve(eval_batch_size);
+    batch.wdls.reserve(eval_batch_size);
+    const auto flush_batch = [&]()
+    {
+        const auto batch_count = static_cast<int64_t>(batch.fens.size());
+        evaluate_batch(parameters, batch, shard.entries);
+
+        const auto loaded = position_count += batch_count;
+        if (loaded / data_load_print_interval != (loaded - batch_count) / data_load_print_interval)
+        {
+            lock_guard<mutex> lock(print_mutex);
             print_elapsed(start);
-            std::cout << "Loaded " << position_count << " entries..." << std::endl;
+            std::cout << "Loaded " << loaded / data_load_print_interval * data_load_print_interval << " entries..." << std::endl;
         }
+    };
+
+    for_each_line(shard.lines, [&](const string_view original_fen)
+    {
+        if (original_fen.empty())
+        {
+            return;
+        }
+
+        parse_line(source, parameters, original_fen, batch);
+        if (batch.fens.size() == eval_batch_size)
+        {
+            flush_batch();
+        }
+    });
+
+    if (!batch.fens.empty())
+    {
+        flush_batch();
+    }
+}
+
+static void load_fens(ThreadPool& thread_pool, const DataSource& source, const parameters_t& parameters, const high_resolution_clock::time_point start, EntrySet& entries, EntryFileWriter* entry_writer)
+{
+    cout << "Loading " << source.path;
+    if(source.position_limit > 0)
+    {
+        cout << " (" << source.position_limit << " positions)";
+    }
+    cout << "..." << endl;
+
+    LineReader reader;
+    if(!reader.open(source.path))
+    {
+        cout << "Failed to open " << source.path << endl;
+        throw runtime_error("Failed to open data source");
+    }
+
+    // Blocks bound the memory used by unmapped inputs, several shards per thread keep every worker busy
+    // when some lines are slower to evaluate than others
+    constexpr size_t block_size = 64 << 20;
+    constexpr int32_t shards_per_thread = 8;
+    const auto shard_count = print_data_entries ? 1 : static_cast<size_t>(thread_pool.thread_count()) * shards_per_thread;
+
+    atomic<int64_t> position_count = 0;
+    mutex print_mutex;
+    int64_t line_budget = source.position_limit > 0 ? source.position_limit : numeric_limits<int64_t>::max();
+    while (line_budget > 0)
+    {
+        const auto block = take_lines(reader.next_block(block_size), line_budget);
+        if (block.empty())
+        {
+            break;
+        }
+
+        vector<LoadShard> shards;
+        split_into_shards(block, shard_count, shards);
+        for (auto& shard : shards)
+        {
+            thread_pool.enqueue([&source, &parameters, start, &shard, &position_count, &print_mutex]()
+            {
+                try
+                {
+                    load_shard(source, parameters, start, shard, position_count, print_mutex);
+                }
+                catch (...)
+                {
+                    shard.error = current_exception();
+                }
+            });
+        }
+
+        thread_pool.wait_for_completion();
+
+        size_t loaded_entries = 0;
+        size_t loaded_coefficients = 0;
+        for (auto& shard : shards)
+        {
+            if (shard.error)
+            {
+                rethrow_exception(shard.error);
+            }
+            loaded_entries += shard.entries.size();
+            loaded_coefficients += shard.entries.coefficients.size();
+        }
+
+        // Shards are appended in file order and released right away, so the block is only held twice briefly
+        entries.reserve(entries.size() + loaded_entries, entries.coefficients.size() + loaded_coefficients);
+        for (auto& shard : shards)
+        {
+            entries.append(shard.entries);
+            shard.entries = EntrySet();
+        }
+
+        // When streaming, entries only pass through memory on their way to the entry file
+        if (entry_writer != nullptr)
+        {
+            entry_writer->write(entries);
+            entries.clear();
+        }
+    }
+
+    const auto total_entries = entry_writer != nullptr ? entry_writer->entry_count() : entries.size();
+    print_elapsed(start);
+    std::cout << "Loaded " << position_count << " entries from " << source.path << ", " << total_entries << " total" << std::endl;
+}
+
+// Splits the entries into range_count ranges of about the same encoded coefficient size, which follows the work an
+// entry takes much more closely than the entry count does. Range i is [splits[i], splits[i + 1]), together the
+// ranges cover every entry exactly once
+static void split_entries(const EntrySet& entries, const size_t range_count, vector<size_t>& splits)
+{
+    const auto& offsets = entries.offsets;
+    splits.resize(range_count + 1);
+    splits[0] = 0;
+    for (size_t range = 1; range < range_count; range++)
+    {
+        const auto target = offsets.back() * range / range_count;
+        const auto split = static_cast<size_t>(lower_bound(offsets.begin(), offsets.end(), target) - offsets.begin());
+        splits[range] = clamp(split, splits[range - 1], entries.size());
+    }
+    splits[range_count] = entries.size();
+}
+
+// Calls range_handler(thread_id, begin, end) on the team for ranges that together cover every entry exactly once.
+// Every thread gets one range, the same share place_entries gave it. With dynamic_work_chunks that share is cut
+// into smaller ranges that the thread works through first, then it takes the ranges other threads have not
+// started yet, so threads that got cheap ranges or more CPU time pick up the rest while most reads stay local
+template<typename F>
+static void run_entry_ranges(WorkerTeam& team, const EntrySet& entries, F&& range_handler)
+{
+    const auto team_size = team.thread_count();
+    const auto ranges_per_thread = dynamic_work_chunks ? work_chunks_per_thread : 1;
+    vector<size_t> splits;
+    split_entries(entries, static_cast<size_t>(team_size) * ranges_per_thread, splits);
+
+    // Next range of every share, splitting team_size * n ranges puts a share boundary at every n-th split, exactly
+    // where splitting team_size ranges puts them
+    vector<CacheAligned<atomic<size_t>>> next_ranges(team_size);
+    team.run([&](const uint32_t thread_id)
+    {
+        for (uint32_t share_offset = 0; share_offset < team_size; share_offset++)
+        {
+            const auto share = (thread_id + share_offset) % team_size;
+            for (auto range = next_ranges[share].value.fetch_add(1, memory_order_relaxed); range < ranges_per_thread;
+                 range = next_ranges[share].value.fetch_add(1, memory_order_relaxed))
+            {
+                const auto index = share * ranges_per_thread + range;
+                if (splits[index] != splits[index + 1])
+                {
+                    range_handler(thread_id, splits[index], splits[index + 1]);
+                }
+            }
+            if constexpr (!dynamic_work_chunks)
+            {
+                break;
+            }
+        }
+    });
+}
+
+// One traversal of the data set that returns the mean squared error and, if with_gradient is set, adds the
+// gradient sum to gradient. Derivatives with respect to K are left to the passes of the K search, k_search_pass
+template<typename Real, bool with_gradient>
+static tune_t fused_pass(WorkerTeam& team, Dataset& dataset, const parameters_t& params, tune_t K, parameters_t* gradient)
+{
+    // Narrow gradients are summed over blocks of entries and each block total is added to a tune_t sum, so the
+    // rounding error depends on the block size instead of the data set size
+    static constexpr size_t gradient_block_size = 1024;
+
+    const auto range_kernel = get_range_kernel<Real>(kernel_isa);
+    kernel_parameters_t<Real> kernel_parameters;
+    get_kernel_parameters<Real>(params, kernel_parameters);
+
+    // Kernels in tune_t add to the thread gradients directly, the kernel parameters are the same type
+    constexpr bool direct_gradient = is_same_v<Real, tune_t>;
+
+    const auto team_size = team.thread_count();
+    vector<CacheAligned<tune_t>> thread_errors(team_size);
+    auto& thread_gradients = dataset.thread_gradients;
+    auto& block_gradients = dataset.get_block_gradients<Real>();
+    if constexpr (with_gradient)
+    {
+        thread_gradients.resize(team_size);
+        block_gradients.resize(direct_gradient ? 0 : team_size);
+        // Every thread zeroes its own sums, so after the first pass their pages are on the NUMA node of that thread
+        team.run([&](const uint32_t thread_id)
+        {
+            thread_gradients[thread_id].assign(kernel_parameters.size(), {});
+            if constexpr (!direct_gradient)
+            {
+                block_gradients[thread_id].assign(kernel_parameters.size(), {});
+            }
+        });
+    }
+
+    dataset.for_each_chunk([&](const EntrySet& entries)
+    {
+        run_entry_ranges(team, entries, [&](const uint32_t thread_id, const size_t start, const size_t end)
+        {
+            const auto kernel_K = static_cast<Real>(K);
+            RangeOutput<Real> output;
+            if constexpr (direct_gradient)
+            {
+                range_kernel(entries, start, end, kernel_parameters, kernel_K, with_gradient ? &thread_gradients[thread_id] : nullptr, output);
+                thread_errors[thread_id].value += output.error.sum;
+                return;
+            }
+
+            auto& gradient = thread_gradients[thread_id];
+            auto& block_gradient = block_gradients[thread_id];
+            for (auto block_start = start; block_start < end;)
+            {
+                const auto block_end = block_start + min(gradient_block_size, end - block_start);
+                range_kernel(entries, block_start, block_end, kernel_parameters, kernel_K, with_gradient ? &block_gradient : nullptr, output);
+                block_start = block_end;
+
+                if constexpr (with_gradient)
+                {
+                    for (size_t parameter_index = 0; parameter_index < params.size(); parameter_index++)
+                    {
+#if TAPERED
+                        gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] += block_gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)];
+                        gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] += block_gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)];
+                        block_gradient[parameter_index] = {};
+#else
+                        gradient[parameter_index] += block_gradient[parameter_index];
+                        block_gradient[parameter_index] = 0;
+#endif
+                    }
+                }
+            }
+            thread_errors[thread_id].value += output.error.sum;
+        });
+    });
+
+    tune_t error = 0;
+    for (uint32_t thread_id = 0; thread_id < team_size; thread_id++)
+    {
+        error += thread_errors[thread_id].value;
+    }
+
+    // The thread gradients are summed in parallel, each thread adds up its own range of parameters
+    if constexpr (with_gradient)
+    {
+        team.run([&](const uint32_t thread_id)
+        {
+            const auto first_parameter = params.size() * thread_id / team_size;
+            const auto last_parameter = params.size() * (thread_id + 1) / team_size;
+            for (uint32_t source_thread = 0; source_thread < team_size; source_thread++)
+            {
+                const auto& thread_gradient = thread_gradients[source_thread];
+                for (auto parameter_index = first_parameter; parameter_index < last_parameter; parameter_index++)
+                {
+#if TAPERED
+                    (*gradient)[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] += thread_gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)];
+                    (*gradient)[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] += thread_gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)];
+#else
+                    (*gradient)[parameter_index] += thread_gradient[parameter_index];
+#endif
+                }
+            }
+        });
+    }
+
+    return error / static_cast<tune_t>(dataset.size());
+}
+
+// First parameter of the share of a thread in the feature major gradient pass, shares are balanced by encoded size
+static size_t get_parameter_split(const TransposedEntrySet& transposed, const uint32_t thread_id, const uint32_t team_size)
+{
+    if (thread_id == team_size)
+    {
+        return transposed.parameter_count();
+    }
+
+    const auto& offsets = transposed.offsets;
+    const auto target = offsets.back() * thread_id / team_size;
+    return static_cast<size_t>(lower_bound(offsets.begin(), offsets.end(), target) - offsets.begin());
+}
+
+// Gradient pass of the feature major engine. The first half evaluates the entries position major and stores the
+// residual of each, already multiplied by its phase weights. The second half walks the transposed coefficients,
+// the gradient of a parameter is the dot product of its row with the weighted residuals, so every gradient value
+// has exactly one writer and no per thread copies or reduction are needed. Adds the gradient sum to gradient
+// and returns the average error
+template<typename Real>
+static tune_t feature_major_gradient_pass(WorkerTeam& team, Dataset& dataset, const parameters_t& params, tune_t K, parameters_t& gradient)
+{
+    const auto& entries = dataset.entries;
+    const auto& transposed = dataset.transposed;
+    const auto range_kernel = get_range_kernel<Real>(kernel_isa);
+    kernel_parameters_t<Real> kernel_parameters;
+    get_kernel_parameters<Real>(params, kernel_parameters);
+
+    auto& weighted_residuals = dataset.get_weighted_residuals<Real>();
+    weighted_residuals.resize(entries.size());
+
+    const auto team_size = team.thread_count();
+    vector<CacheAligned<tune_t>> thread_errors(team_size);
+    run_entry_ranges(team, entries, [&](const uint32_t thread_id, const size_t start, const size_t end)
+    {
+        array<Real, residual_block_size> residuals;
+        RangeOutput<Real> output;
+        output.residuals = residuals.data();
+        for (auto block_start = start; block_start < end;)
+        {
+            const auto block_end = block_start + min(residual_block_size, end - block_start);
+            range_kernel(entries, block_start, block_end, kernel_parameters, static_cast<Real>(K), nullptr, output);
+            for (auto entry_index = block_start; entry_index < block_end; entry_index++)
+            {
+                const auto residual = residuals[entry_index - block_start];
+#if TAPERED
+                const auto& header = entries.headers[entry_index];
+                weighted_residuals[entry_index][static_cast<int32_t>(PhaseStages::Midgame)] = residual * static_cast<Real>(header.midgame_weight);
+                weighted_residuals[entry_index][static_cast<int32_t>(PhaseStages::Endgame)] = residual * static_cast<Real>(header.endgame_weight);
+#else
+                weighted_residuals[entry_index] = residual;
+#endif
+            }
+            block_start = block_end;
+        }
+        thread_errors[thread_id].value += output.error.sum;
+    });
+
+    team.run([&](const uint32_t thread_id)
+    {
+        const auto first_parameter = get_parameter_split(transposed, thread_id, team_size);
+        const auto last_parameter = get_parameter_split(transposed, thread_id + 1, team_size);
+        for (auto parameter_index = first_parameter; parameter_index < last_parameter; parameter_index++)
+        {
+            const auto coefficients_begin = transposed.coefficients.data() + transposed.offsets[parameter_index];
+            const auto coefficients_end = transposed.coefficients.data() + transposed.offsets[parameter_index + 1];
+#if TAPERED
+            tune_t midgame = 0;
+            tune_t endgame = 0;
+            decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t entry_index)
+            {
+                midgame += static_cast<tune_t>(static_cast<Real>(value) * weighted_residuals[entry_index][static_cast<int32_t>(PhaseStages::Midgame)]);
+                endgame += static_cast<tune_t>(static_cast<Real>(value) * weighted_residuals[entry_index][static_cast<int32_t>(PhaseStages::Endgame)]);
+            });
+            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] += midgame;
+            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] += endgame;
+#else
+            tune_t sum = 0;
+            decode_coefficients(coefficients_begin, coefficients_end, [&](const int32_t value, const int32_t entry_index)
+            {
+                sum += static_cast<tune_t>(static_cast<Real>(value) * weighted_residuals[entry_index]);
+            });
+            gradient[parameter_index] += sum;
+#endif
+        }
+    });
+
+    tune_t error = 0;
+    for (uint32_t thread_id = 0; thread_id < team_size; thread_id++)
+    {
+        error += thread_errors[thread_id].value;
+    }
+    return error / static_cast<tune_t>(entries.size());
+}
+
+template<typename Real>
+static tune_t get_average_error(WorkerTeam& team, Dataset& dataset, const parameters_t& parameters, tune_t K)
+{
+    return fused_pass<Real, false>(team, dataset, parameters, K, nullptr);
+}
+
+// Adds the gradient sum to gradient and returns the average error of params
+template<typename Real>
+static tune_t compute_gradient(WorkerTeam& team, parameters_t& gradient, Dataset& dataset, const parameters_t& params, tune_t K)
+{
+    if (gradient_engine == GradientEngine::FeatureMajor)
+    {
+        return feature_major_gradient_pass<Real>(team, dataset, params, K, gradient);
+    }
+    return fused_pass<Real, true>(team, dataset, params, K, &gradient);
+}
+
+// Error of the data set and its first two derivatives with respect to K
+struct KDerivatives
+{
+    tune_t error = 0;
+    tune_t first = 0;
+    tune_t second = 0;
+};
+
+// One traversal that evaluates every entry once and adds up the error and K derivatives of each candidate K from
+// that eval. Always runs in tune_t, so the derivatives stay accurate close to the optimum
+static void k_search_pass(WorkerTeam& team, Dataset& dataset, const parameters_t& parameters, const vector<tune_t>& candidates, vector<KDerivatives>& results)
+{
+    const auto team_size = team.thread_count();
+    vector<CacheAligned<vector<KDerivatives>>> thread_results(team_size);
+    for (auto& thread_result : thread_results)
+    {
+        thread_result.value.assign(candidates.size(), KDerivatives{});
+    }
+
+    dataset.for_each_chunk([&](const EntrySet& entries)
+    {
+        run_entry_ranges(team, entries, [&](const uint32_t thread_id, const size_t begin, const size_t end)
+        {
+            auto& sums = thread_results[thread_id].value;
+            for (auto entry_index = begin; entry_index < end; entry_index++)
+            {
+                const auto eval = linear_eval<tune_t>(entries, entry_index, parameters);
+                const auto wdl = entries.headers[entry_index].get_wdl();
+                const auto scaled_eval = eval / static_cast<tune_t>(400);
+                for (size_t candidate = 0; candidate < candidates.size(); candidate++)
+                {
+                    // With s = sigmoid(K * eval / 400): ds/dK = s * (1 - s) * eval / 400 and
+                    // d2s/dK2 = s * (1 - s) * (1 - 2 * s) * (eval / 400)^2
+                    const auto sig = sigmoid(candidates[candidate], eval);
+                    const auto diff = wdl - sig;
+                    const auto slope = sig * (1 - sig);
+                    const auto sig_first = slope * scaled_eval;
+                    const auto sig_second = slope * (1 - 2 * sig) * scaled_eval * scaled_eval;
+                    auto& sum = sums[candidate];
+                    sum.error += diff * diff;
+                    sum.first -= 2 * diff * sig_first;
+                    sum.second += 2 * (sig_first * sig_first - diff * sig_second);
+                }
+            }
+        });
+    });
+
+    const auto entry_count = static_cast<tune_t>(dataset.size());
+    results.assign(candidates.size(), KDerivatives{});
+    for (size_t candidate = 0; candidate < candidates.size(); candidate++)
+    {
+        for (uint32_t thread_id = 0; thread_id < team_size; thread_id++)
+        {
+            const auto& sum = thread_results[thread_id].value[candidate];
+            results[candidate].error += sum.error;
+            results[candidate].first += sum.first;
+            results[candidate].second += sum.second;
+        }
+        results[candidate].error /= entry_count;
+        results[candidate].first /= entry_count;
+        results[candidate].second /= entry_count;
+    }
+}
+
+// The first pass evaluates a geometric spread of candidate Ks, the best of them and its neighbours bracket the
+// optimum. From there every pass takes a Newton step on the K derivative of the error, or bisects the bracket if
+// the step would leave it or the error is not convex at K
+static tune_t find_optimal_k(WorkerTeam& team, Dataset& dataset, const parameters_t& parameters)
+{
+    constexpr int32_t candidate_count = 16;
+    constexpr tune_t first_candidate = 0.125;
+    constexpr tune_t candidate_ratio = 1.41421356237309504880;
+    constexpr tune_t deviation_goal = 1e-9;
+    constexpr int32_t max_iterations = 50;
+    // Used when every eval is 0, such as for zeroed parameters, and the error does not depend on K
+    constexpr tune_t default_K = 2.5;
+
+    vector<tune_t> candidates(candidate_count);
+    for (int32_t candidate = 0; candidate < candidate_count; candidate++)
+    {
+        candidates[candidate] = first_candidate * pow(candidate_ratio, candidate);
+    }
+    vector<KDerivatives> results;
+    k_search_pass(team, dataset, parameters, candidates, results);
+    if (all_of(results.begin(), results.end(), [](const KDerivatives& result) { return result.first == 0; }))
+    {
+        cout << "The error does not depend on K, using K = " << default_K << endl;
+        return default_K;
+    }
+
+    const auto best = static_cast<size_t>(min_element(results.begin(), results.end(), [](const KDerivatives& a, const KDerivatives& b)
+    {
+        return a.error < b.error;
+    }) - results.begin());
+    tune_t low = best > 0 ? candidates[best - 1] : 0;
+    tune_t high = best + 1 < candidates.size() ? candidates[best + 1] : candidates.back() * candidate_ratio * candidate_ratio;
+    tune_t K = candidates[best];
+    auto current = results[best];
+    cout << "Best of " << candidate_count << " candidate Ks: " << K << ", error: " << current.error << endl;
+
+    vector<tune_t> next_candidate(1);
+    for (int32_t iteration = 0; iteration < max_iterations && fabs(current.first) > deviation_goal; iteration++)
+    {
+        if (current.first > 0)
+        {
+            high = K;
+        }
+        else
+        {
+            low = K;
+        }
+
+        const auto newton_K = K - current.first / current.second;
+        const auto newton_usable = current.second > 0 && newton_K > low && newton_K < high;
+        K = newton_usable ? newton_K : (low + high) / 2;
+
+        next_candidate[0] = K;
+        k_search_pass(team, dataset, parameters, next_candidate, results);
+        current = results[0];
+        cout << "Current K: " << K << ", error: " << current.error << ", deviation: " << current.first << endl;
+    }
+
+    return K;
+}
+
+static void load_dataset(ThreadPool& thread_pool, const vector<DataSource>& sources, const parameters_t& parameters, const high_resolution_clock::time_point start, Dataset& dataset)
+{
+    auto& entries = dataset.entries;
+    const auto use_data_cache = enable_data_cache && can_cache_sources(sources);
+    const auto cache_key = get_data_cache_key(sources, parameters);
+    const auto cache_path = get_data_cache_path(sources, cache_key);
+    if constexpr (enable_streaming)
+    {
+        // The data cache doubles as the entry file to stream from, it is only kept if it could be reused
+        constexpr uint64_t memory_budget = static_cast<uint64_t>(streaming_memory_budget_mb) << 20;
+        if (use_data_cache && dataset.stream.open(cache_path, cache_key, memory_budget))
+        {
+            print_elapsed(start);
+            cout << "Streaming " << dataset.stream.size() << " entries from data cache " << cache_path << endl;
+        }
+        else
+        {
+            EntryFileWriter entry_writer;
+            if (!entry_writer.open(cache_path, cache_key))
+            {
+                cout << "Failed to create entry file " << cache_path << endl;
+                throw runtime_error("Failed to create entry file");
+            }
+
+            for (const auto& source : sources)
+            {
+                load_fens(thread_pool, source, parameters, start, entries, &entry_writer);
+            }
+
+            if (!entry_writer.close() || !dataset.stream.open(cache_path, cache_key, memory_budget))
+            {
+                throw runtime_error("Failed to open entry file");
+            }
+            if (use_data_cache)
+            {
+                remove_superseded_data_caches(cache_path);
+            }
+        }
+        dataset.streaming = true;
+        if (!use_data_cache)
+        {
+            dataset.temporary_entry_file = cache_path;
+        }
+        cout << "Streaming " << dataset.stream.chunk_count() << " chunks, reading up to " << dataset.stream.read_ahead() << " ahead" << endl;
+    }
+    else if (use_data_cache && load_data_cache(cache_path, cache_key, entries))
+    {
+        print_elapsed(start);
+        cout << "Loaded " << entries.size() << " entries from data cache " << cache_path << endl;
+    }
+    else
+    {
+        for (const auto& source : sources)
+        {
+            load_fens(thread_pool, source, parameters, start, entries, nullptr);
+        }
+
+        if (use_data_cache)
+        {
+            cout << "Writing data cache " << cache_path << "..." << endl;
+            save_data_cache(cache_path, cache_key, entries);
+        }
+    }
+    cout << "Data loading complete" << endl << endl;
+
+    if (!dataset.streaming)
+    {
+        cout << "Encoded coefficients: " << entries.coefficients.size() / (1 << 20) << " MB, "
+             << static_cast<double>(entries.coefficients.size()) / max<size_t>(entries.size(), 1) << " bytes per entry" << endl;
+    }
+}
+
+// Copies the entries into fresh buffers, each thread copying the share of entries it evaluates (with
+// dynamic_work_chunks, the share it evaluates first). Pages are allocated on the NUMA node of the thread that touches them first, so with
+// pinned threads each share ends up local to the thread that reads it every pass
+static void place_entries(WorkerTeam& team, EntrySet& entries)
+{
+    EntrySet placed;
+    placed.coefficients.resize(entries.coefficients.size());
+    placed.offsets.resize(entries.offsets.size());
+    placed.headers.resize(entries.headers.size());
+    vector<size_t> splits;
+    split_entries(entries, team.thread_count(), splits);
+    // Each thread copies the end offsets of its entries, the buffer is uninitialized so the leading 0 is set here
+    placed.offsets[0] = 0;
+    team.run([&](const uint32_t thread_id)
+    {
+        const auto first_entry = splits[thread_id];
+        const auto last_entry = splits[thread_id + 1];
+        copy(entries.offsets.begin() + first_entry + 1, entries.offsets.begin() + last_entry + 1, placed.offsets.begin() + first_entry + 1);
+        copy(entries.headers.begin() + first_entry, entries.headers.begin() + last_entry, placed.headers.begin() + first_entry);
+        copy(entries.coefficients.begin() + entries.offsets[first_entry], entries.coefficients.begin() + entries.offsets[last_entry],
+             placed.coefficients.begin() + entries.offsets[first_entry]);
+    });
+    entries = move(placed);
+}
+
+static void start_worker_team(WorkerTeam& team, Dataset& dataset)
+{
+    team.start(get_thread_count(), pin_threads);
+    cout << "Running passes on " << team.thread_count() << " threads" << (team.are_threads_pinned() ? ", pinned to CPUs" : "") << endl;
+    if (team.are_threads_pinned() && !dataset.streaming && team.thread_count() > 1)
+    {
+        place_entries(team, dataset.entries);
+    }
+}
+
+// The feature major engine needs every entry in memory, a streamed data set always uses the position major one
+static void prepare_gradient_engine(Dataset& dataset, const size_t parameter_count, const bool feature_major)
+{
+    if (!feature_major || dataset.streaming)
+    {
+        if (feature_major)
+        {
+            cout << "Feature major gradients need the data set in memory, using position major gradients" << endl;
+        }
+        dataset.transposed.clear();
+        dataset.float_weighted_residuals.clear();
+        dataset.double_weighted_residuals.clear();
+        gradient_engine = GradientEngine::PositionMajor;
+        return;
+    }
+
+    if (dataset.transposed.parameter_count() != parameter_count)
+    {
+        dataset.transposed.build(dataset.entries, parameter_count);
+        cout << "Transposed coefficients: " << dataset.transposed.coefficients.size() / (1 << 20) << " MB" << endl;
+    }
+    gradient_engine = GradientEngine::FeatureMajor;
+}
+
+static const char* get_gradient_engine_name(const GradientEngine engine)
+{
+    return engine == GradientEngine::FeatureMajor ? "feature major" : "position major";
+}
+
+static void zero_parameters(parameters_t& parameters)
+{
+    for (auto& parameter : parameters)
+    {
+#if TAPERED
+        parameter[static_cast<int>(PhaseStages::Midgame)] = static_cast<tune_t>(0);
+        parameter[static_cast<int>(PhaseStages::Endgame)] = static_cast<tune_t>(0);
+#else
+        parameter = static_cast<tune_t>(0);
+#endif            
+    }
+}
+
+static tune_t get_k(WorkerTeam& team, Dataset& dataset, const parameters_t& parameters)
+{
+    tune_t K;
+    if constexpr (preferred_k <= 0)
+    {
+        cout << "Finding optimal K..." << endl;
+        K = find_optimal_k(team, dataset, parameters);
+    }
+    else
+    {
+        cout << "Using predefined K = " << preferred_k <<  endl;
+        K = preferred_k;
+    }
+    cout << "K = " << K << endl;
+    return K;
+}
+
+// Adds up weight * x * x^T over the entries into normal, the full matrix or its 2x2 blocks, and, if right_hand_side
+// is set, weight * target * x into it, x being the coefficients of an entry times its phase weights. get_weight(entries, entry_index, target) returns the
+// weight of an entry and may store its target. A first pass stores the weights and targets of every entry, then
+// every thread walks all entries but only adds to its own rows of the upper triangle, so no thread needs a copy
+// of the matrix
+template<typename WeightFunction>
+static void accumulate_normal_equations(WorkerTeam& team, Dataset& dataset, const size_t variable_count, const bool full, const WeightFunction& get_weight,
+                                        NormalMatrix& normal, vector<tune_t>* right_hand_side)
+{
+    normal.reset(variable_count, full);
+    if (right_hand_side != nullptr)
+    {
+        right_hand_side->assign(variable_count, 0);
     }
 
-    print_elapsed(start);
-    std::cout << "Loaded " << position_count << " entries from " << source.path << ", " << entries.size() << " total" << std::endl;
+    // Earlier rows hold more of the upper triangle, so the full matrix is split into row ranges of equal area
+    const auto team_size = team.thread_count();
+    vector<size_t> row_splits(team_size + 1);
+    for (uint32_t thread_id = 0; thread_id < team_size; thread_id++)
+    {
+        const auto fraction = static_cast<tune_t>(thread_id) / team_size;
+        const auto row_fraction = normal.full ? 1 - sqrt(1 - fraction) : fraction;
+        row_splits[thread_id] = min(static_cast<size_t>(row_fraction * variable_count), variable_count);
+    }
+    row_splits[team_size] = variable_count;
+
+    vector<tune_t> weights;
+    vector<tune_t> targets;
+    dataset.for_each_chunk([&](const EntrySet& entries)
+    {
+        weights.resize(entries.size());
+        targets.resize(entries.size());
+        run_entry_ranges(team, entries, [&](const uint32_t thread_id, const size_t begin, const size_t end)
+        {
+            for (auto entry_index = begin; entry_index < end; entry_index++)
+            {
+                weights[entry_index] = get_weight(entries, entry_index, targets[entry_index]);
+            }
+        });
+
+        team.run([&](const uint32_t thread_id)
+        {
+            const auto first_row = row_splits[thread_id];
+            const auto last_row = row_splits[thread_id + 1];
+            thread_local vector<pair<size_t, tune_t>> terms;
+            for (size_t entry_index = 0; entry_index < entries.size(); entry_index++)
+            {
+                const auto& header = entries.headers[entry_index];
+                terms.clear();
+                decode_coefficients(entries.coefficients.data() + entries.offsets[entry_index], entries.coefficients.data() + entries.offsets[entry_index + 1],
+                                    [&](const int32_t value, const int32_t index)
+                {
+#if TAPERED
+                    terms.emplace_back(index * phase_count, value * header.midgame_weight);
+                    terms.emplace_back(index * phase_count + 1, value * header.endgame_weight);
+#else
+                    terms.emplace_back(index, value);
+#endif
+                });
+
+                auto term = lower_bound(terms.begin(), terms.end(), first_row, [](const pair<size_t, tune_t>& term, const size_t row)
+                {
+                    return term.first < row;
+                });
+                for (; term != terms.end() && term->first < last_row; ++term)
+                {
+                    const auto [row, row_value] = *term;
+                    const auto weighted_value = weights[entry_index] * row_value;
+                    if (right_hand_side != nullptr)
+                    {
+                        (*right_hand_side)[row] += weighted_value * targets[entry_index];
+                    }
+                    if (normal.full)
+                    {
+                        const auto matrix_row = &normal.values[row * variable_count];
+                        for (auto column = term; column != terms.end(); ++column)
+                        {
+                            matrix_row[column->first] += weighted_value * column->second;
+                        }
+                    }
+                    else
+                    {
+                        const auto block = row / phase_count;
+                        const auto block_values = &normal.values[block * phase_count * phase_count];
+                        for (auto column = term; column != terms.end() && column->first / phase_count == block; ++column)
+                        {
+                            block_values[(row % phase_count) * phase_count + column->first % phase_count] += weighted_value * column->second;
+                        }
+                    }
+                }
+            }
+        });
+    });
+}
+
+// Adds up the Gauss-Newton normal matrix 2 / N * sum of (K / 400 * sigmoid * (1 - sigmoid))^2 * x * x^T
+static void accumulate_normal_matrix(WorkerTeam& team, Dataset& dataset, const parameters_t& parameters, const tune_t K, NormalMatrix& normal)
+{
+    const auto sigmoid_slope_scale = K / static_cast<tune_t>(400);
+    const auto weight_scale = 2 / static_cast<tune_t>(dataset.size());
+    accumulate_normal_equations(team, dataset, parameters.size() * phase_count, gauss_newton_full_matrix, [&](const EntrySet& entries, const size_t entry_index, tune_t& target)
+    {
+        const auto sig = sigmoid(K, linear_eval<tune_t>(entries, entry_index, parameters));
+        const auto slope = sigmoid_slope_scale * sig * (1 - sig);
+        return weight_scale * slope * slope;
+    }, normal, nullptr);
 }
 
-static tune_t sigmoid(const tune_t K, const tune_t eval)
+// Solves the linearized problem once: weighted least squares of the evals against the evals that would predict the
+// wdl exactly, logit(wdl) * 400 / K, with the wdl clipped away from 0 and 1 where the logit has no finite value.
+// Entries are weighted equally: weighting them by the slope of the sigmoid at their clipped wdl lets the draws
+// outweigh the decisive results and lands further from the minimum of the error. Always solves the full matrix,
+// as the 2x2 blocks alone fit every parameter as if the others did not exist
+static void warm_start_parameters(WorkerTeam& team, Dataset& dataset, parameters_t& parameters, const tune_t K)
 {
-    return static_cast<tune_t>(1) / (static_cast<tune_t>(1) + exp(-K * eval / static_cast<tune_t>(400)));
+    constexpr tune_t ridge = 1e-6;
+
+    const auto variable_count = parameters.size() * phase_count;
+    const auto eval_scale = static_cast<tune_t>(400) / K;
+    NormalMatrix normal;
+    vector<tune_t> solution;
+    accumulate_normal_equations(team, dataset, variable_count, true, [&](const EntrySet& entries, const size_t entry_index, tune_t& target)
+    {
+        const auto& header = entries.headers[entry_index];
+        const auto wdl = clamp<tune_t>(header.get_wdl(), warm_start_wdl_clip, 1 - warm_start_wdl_clip);
+        target = eval_scale * log(wdl / (1 - wdl)) - static_cast<tune_t>(header.additional_score);
+        return static_cast<tune_t>(1);
+    }, normal, &solution);
+
+    if (!solve_normal_equations(normal, ridge, solution))
+    {
+        cout << "Least squares warm start failed, starting from the current parameters" << endl;
+        return;
+    }
+
+    copy(solution.begin(), solution.end(), get_variables(parameters));
+    cout << "Least squares warm start done" << endl;
 }
 
-static tune_t get_average_error(ThreadPool& thread_pool, const vector<Entry>& entries, const parameters_t& parameters, tune_t K)
+// The mean squared error of a data set, evaluated by the passes of the worker team with Real kernels
+template<typename Real>
+class DatasetObjective : public Objective
+{
+public:
+    DatasetObjective(WorkerTeam& team, Dataset& dataset, const tune_t K)
+        : team(team), dataset(dataset), K(K)
+    {
+    }
+
+    tune_t evaluate(const parameters_t& parameters, parameters_t* gradient) override
+    {
+        if (gradient == nullptr)
+        {
+            return get_average_error<Real>(team, dataset, parameters, K);
+        }
+
+        gradient->assign(parameters.size(), {});
+        const auto error = compute_gradient<Real>(team, *gradient, dataset, parameters, K);
+
+        // The passes sum (wdl - sigmoid) * sigmoid * (1 - sigmoid) * x, the derivative of the mean squared error is that times -2 * K / 400 / N
+        const auto scale = -2 * K / (static_cast<tune_t>(400) * static_cast<tune_t>(dataset.size()));
+        const auto variables = get_variables(*gradient);
+        tune_t squared_norm = 0;
+        for (size_t variable = 0; variable < gradient->size() * phase_count; variable++)
+        {
+            variables[variable] *= scale;
+            squared_norm += variables[variable] * variables[variable];
+        }
+        gradient_norm = sqrt(squared_norm);
+        return error;
+    }
+
+    // Euclidean norm of the latest gradient evaluated
+    tune_t get_gradient_norm() const
+    {
+        return gradient_norm;
+    }
+
+    tune_t evaluate_normal(const parameters_t& parameters, parameters_t& gradient, NormalMatrix& normal) override
+    {
+        const auto error = evaluate(parameters, &gradient);
+        accumulate_normal_matrix(team, dataset, parameters, K, normal);
+        return error;
+    }
+
+private:
+    WorkerTeam& team;
+    Dataset& dataset;
+    tune_t K;
+    tune_t gradient_norm = 0;
+};
+
+// Watches the full data set epochs: decays the step size once the error stops falling and decides when more
+// epochs are not worth running. All criteria are off when their config value is 0
+class ConvergenceMonitor
 {
-    array<tune_t, thread_count> thread_errors;
-    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+public:
+    explicit ConvergenceMonitor(const high_resolution_clock::time_point loop_start)
+        : loop_start(loop_start)
+    {
+    }
+
+    // Called after each epoch with the error and gradient norm of the parameters it started from, previous, and
+    // the parameters it ended with. Returns why tuning should stop, or nullptr to go on
+    const char* update(const tune_t error, const tune_t gradient_norm, const parameters_t& previous, const parameters_t& parameters, Optimizer& optimizer)
+    {
+        return update(error, gradient_norm, previous, parameters, [&](const tune_t ratio)
+        {
+            optimizer.scale_step_size(ratio);
+        });
+    }
+
+    // Like above for tuning without an Optimizer, scale_step_size(ratio) scales the step size of the later epochs
+    template<typename F>
+    const char* update(const tune_t error, const tune_t gradient_norm, const parameters_t& previous, const parameters_t& parameters, F&& scale_step_size)
     {
-        thread_pool.enqueue([thread_id, &thread_errors, &entries, &parameters, K]()
+        if (lr_plateau_patience > 0)
         {
-            const auto entries_per_thread = entries.size() / thread_count;
-            const auto start = static_cast<int>(thread_id * entries_per_thread);
-            const auto end = static_cast<int>((thread_id + 1) * entries_per_thread - 1);
-            tune_t error = 0;
-            for (int i = start; i < end; i++)
+            if (error < best_error * (1 - min_relative_improvement))
             {
-                const auto& entry = entries[i];
-                const auto eval = linear_eval(entry, parameters);
-                const auto sig = sigmoid(K, eval);
-                const auto diff = entry.wdl - sig;
-                const auto entry_error = pow(diff, 2);
-                error += entry_error;
+                best_error = error;
+                epochs_without_improvement = 0;
             }
-            thread_errors[thread_id] = error;
-        });
+            else if (++epochs_without_improvement >= lr_plateau_patience)
+            {
+                scale_step_size(static_cast<tune_t>(lr_plateau_ratio));
+                best_error = min(best_error, error);
+                epochs_without_improvement = 0;
+            }
+        }
+
+        if (convergence_window > 0)
+        {
+            window_errors.push_back(error);
+            if (window_errors.size() > static_cast<size_t>(convergence_window))
+            {
+                const auto improvement = (window_errors.front() - error) / window_errors.front();
+                window_errors.pop_front();
+                if (improvement < min_relative_improvement)
+                {
+                    return "the error stopped improving";
+                }
+            }
+        }
+
+        if (convergence_gradient_norm > 0 && gradient_norm < convergence_gradient_norm)
+        {
+            return "the gradient norm fell below the threshold";
+        }
+
+        const auto variable_count = parameters.size() * phase_count;
+        const auto previous_variables = get_variables(previous);
+        const auto variables = get_variables(parameters);
+        if (convergence_max_change > 0)
+        {
+            tune_t max_change = 0;
+            for (size_t variable = 0; variable < variable_count; variable++)
+            {
+                max_change = max(max_change, abs(variables[variable] - previous_variables[variable]));
+            }
+            if (max_change < convergence_max_change)
+            {
+                return "no parameter moved by the threshold";
+            }
+        }
+
+        // The printed parameters are rounded to whole centipawns, after the eval rebalanced a scratch copy of them
+        if (rounded_stable_epochs > 0)
+        {
+            auto printed_variables = variables;
+            if constexpr (RebalancedEval<TuneEval>)
+            {
+                printed = parameters;
+                TuneEval::rebalance_parameters(printed);
+                printed_variables = get_variables(printed);
+            }
+
+            rounded.resize(variable_count);
+            bool changed = false;
+            for (size_t variable = 0; variable < variable_count; variable++)
+            {
+                const auto value = static_cast<int32_t>(round(printed_variables[variable]));
+                changed |= value != rounded[variable];
+                rounded[variable] = value;
+            }
+            epochs_rounded_stable = changed ? 0 : epochs_rounded_stable + 1;
+            if (epochs_rounded_stable >= rounded_stable_epochs)
+            {
+                return "the rounded parameters stopped changing";
+            }
+        }
+
+        if (max_tune_seconds > 0 && duration<double>(high_resolution_clock::now() - loop_start).count() >= max_tune_seconds)
+        {
+            return "the time budget ran out";
+        }
+        return nullptr;
     }
 
-    thread_pool.wait_for_completion();
+private:
+    high_resolution_clock::time_point loop_start;
+    tune_t best_error = numeric_limits<tune_t>::max();
+    int32_t epochs_without_improvement = 0;
+    deque<tune_t> window_errors;
+    parameters_t printed;
+    vector<int32_t> rounded;
+    int32_t epochs_rounded_stable = 0;
+};
 
-    tune_t total_error = 0;
-    for (int thread_id = 0; thread_id < thread_count; thread_id++)
+// Copies the entries at indices into batch, each thread copying an equal share
+static void gather_entries(WorkerTeam& team, const EntrySet& entries, const uint32_t* indices, const size_t count, EntrySet& batch)
+{
+    batch.offsets.resize(count + 1);
+    batch.headers.resize(count);
+    for (size_t batch_index = 0; batch_index < count; batch_index++)
     {
-        total_error += thread_errors[thread_id];
+        const auto entry_index = indices[batch_index];
+        batch.offsets[batch_index + 1] = batch.offsets[batch_index] + entries.offsets[entry_index + 1] - entries.offsets[entry_index];
     }
+    batch.coefficients.resize(batch.offsets[count]);
 
-    const tune_t avg_error = total_error / static_cast<tune_t>(entries.size());
-    return avg_error;
+    team.run([&](const uint32_t thread_id)
+    {
+        const auto first_index = count * thread_id / team.thread_count();
+        const auto last_index = count * (thread_id + 1) / team.thread_count();
+        for (auto batch_index = first_index; batch_index < last_index; batch_index++)
+        {
+            const auto entry_index = indices[batch_index];
+            batch.headers[batch_index] = entries.headers[entry_index];
+            copy(entries.coefficients.begin() + entries.offsets[entry_index], entries.coefficients.begin() + entries.offsets[entry_index + 1],
+                 batch.coefficients.begin() + batch.offsets[batch_index]);
+        }
+    });
 }
 
-static tune_t find_optimal_k(ThreadPool& thread_pool, const vector<Entry>& entries, const parameters_t& parameters)
+// Mini-batches need random access to the entries, so a streamed data set is always tuned in full batches
+static bool use_mini_batches(const Dataset& dataset)
 {
-    constexpr tune_t rate = 10;
-    constexpr tune_t delta = 1e-5;
-    constexpr tune_t deviation_goal = 1e-6;
-    tune_t K = 2.5;
-    tune_t deviation = 1;
-
-    while (fabs(deviation) > deviation_goal)
+    if constexpr (mini_batch_size <= 0)
     {
-        const tune_t up = get_average_error(thread_pool, entries, parameters, K + delta);
-        const tune_t down = get_average_error(thread_pool, entries, parameters, K - delta);
-        deviation = (up - down) / (2 * delta);
-        cout << "Current K: " << K << ", up: " << up << ", down: " << down << ", deviation: " << deviation << endl;
-        K -= deviation * rate;
+        return false;
     }
 
-    return K;
+    if (dataset.streaming)
+    {
+        cout << "Mini-batches need the data set in memory, tuning in full batches" << endl;
+        return false;
+    }
+    return static_cast<uint64_t>(mini_batch_size) < dataset.size();
 }
 
-static void update_single_gradient(parameters_t& gradient, const Entry& entry, const parameters_t& params, tune_t K) {
+// Every epoch shuffles the order of the entries and takes an Adam step per batch of mini_batch_size entries. Only
+// a permutation of the entry indices is shuffled, each batch is gathered through it into a separate entry set and
+// sorted first, so the gather reads the entries in memory order
+static void tune_mini_batches(WorkerTeam& team, Dataset& dataset, parameters_t& parameters, const tune_t K, const high_resolution_clock::time_point start)
+{
+    // Only reached with mini_batch_size > 0, the body is discarded otherwise so the batch count never divides by 0
+    if constexpr (mini_batch_size > 0)
+    {
+        const auto& entries = dataset.entries;
+        vector<uint32_t> permutation(entries.size());
+        iota(permutation.begin(), permutation.end(), 0);
+        mt19937_64 generator(mini_batch_shuffle_seed);
+        const auto batch_size = static_cast<size_t>(mini_batch_size);
+        const auto batch_count = (permutation.size() + batch_size - 1) / batch_size;
+        cout << "Tuning in " << batch_count << " mini-batches of up to " << batch_size << " entries per epoch" << endl;
+
+        // Curvature estimates from single batches would mislead L-BFGS and Gauss-Newton, batches always use Adam
+        if constexpr (optimizer_type != OptimizerType::Adam)
+        {
+            cout << "Warning: mini-batches always use the Adam optimizer, optimizer_type " << get_optimizer_name(optimizer_type) << " is ignored" << endl;
+        }
+        const auto optimizer = make_optimizer(OptimizerType::Adam);
+        Dataset batch;
+        DatasetObjective<kernel_real_t> batch_objective(team, batch, K);
+        const auto loop_start = high_resolution_clock::now();
+        ConvergenceMonitor monitor(loop_start);
+        parameters_t previous_parameters;
+        for (int epoch = 1; epoch <= max_epoch; epoch++)
+        {
+            previous_parameters = parameters;
+            shuffle(permutation.begin(), permutation.end(), generator);
+            tune_t epoch_error = 0;
+            tune_t epoch_gradient_norm = 0;
+            for (size_t batch_start = 0; batch_start < permutation.size(); batch_start += batch_size)
+            {
+                const auto batch_end = min(batch_start + batch_size, permutation.size());
+                sort(permutation.begin() + batch_start, permutation.begin() + batch_end);
+                gather_entries(team, entries, &permutation[batch_start], batch_end - batch_start, batch.entries);
+
+                const auto batch_error = optimizer->step(batch_objective, parameters);
+                epoch_error += batch_error * static_cast<tune_t>(batch_end - batch_start);
+                epoch_gradient_norm += batch_objective.get_gradient_norm() * static_cast<tune_t>(batch_end - batch_start);
+            }
 
-    const tune_t eval = linear_eval(entry, params);
-    const tune_t sig = sigmoid(K, eval);
-    const tune_t res = (entry.wdl - sig) * sig * (1 - sig);
+            // Each batch error and gradient is measured before the step on that batch, so these trail the current
+            // parameters. The noise of the batches adds to their gradient norms, so their mean stays above the norm of
+            // the full gradient and convergence_gradient_norm stops no earlier than it would in full batches
+            const auto error = epoch_error / static_cast<tune_t>(entries.size());
+            const auto gradient_norm = epoch_gradient_norm / static_cast<tune_t>(entries.size());
+            const auto stop_reason = monitor.update(error, gradient_norm, previous_parameters, parameters, *optimizer);
 
-#if TAPERED
-    const auto mg_base = res * (entry.phase / static_cast<tune_t>(24));
-    const auto eg_base = res - mg_base;
-#endif
+            const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - loop_start).count();
+            print_elapsed(start);
+            cout << "Epoch " << epoch << " (" << epoch * 1000.0 / max<int64_t>(elapsed_ms, 1) << " eps), mean batch error "
+                 << error << ", " << optimizer->get_status() << endl;
+            TuneEval::print_parameters(parameters);
+            if (stop_reason != nullptr)
+            {
+                cout << "Stopping after epoch " << epoch << ", " << stop_reason << endl;
+                break;
+            }
+        }
+
+        cout << "Final error = " << get_average_error<tune_t>(team, dataset, parameters, K) << endl;
+    }
+}
 
-    for (const auto& coefficient : entry.coefficients)
+// Like mini-batches, asynchronous SGD needs random access to the entries
+static bool use_asynchronous_sgd(const Dataset& dataset)
+{
+    if constexpr (!asynchronous_sgd)
     {
-#if TAPERED
-        gradient[coefficient.index][static_cast<int32_t>(PhaseStages::Midgame)] += mg_base * coefficient.value;
-        gradient[coefficient.index][static_cast<int32_t>(PhaseStages::Endgame)] += eg_base * coefficient.value * entry.endgame_scale;
-#else
-        gradient[coefficient.index] += res * coefficient.value;
-#endif
+        return false;
+    }
+
+    if (dataset.streaming)
+    {
+        cout << "Asynchronous SGD needs the data set in memory, tuning in full batches" << endl;
+        return false;
     }
+    return true;
 }
 
-static void compute_gradient(ThreadPool& thread_pool, parameters_t& gradient, const vector<Entry>& entries, const parameters_t& params, tune_t K)
+// Hogwild style SGD. Every thread walks its own share of the entries in a freshly shuffled order each epoch and
+// updates the shared parameters right after each entry, without locks or barriers. Parameters are accessed
+// through relaxed atomic references, so an update that races with one of another thread can be lost. That is
+// rare, as an entry only touches a few dozen of the parameters
+static void tune_asynchronous(WorkerTeam& team, Dataset& dataset, parameters_t& parameters, const tune_t K, const high_resolution_clock::time_point start)
 {
-    array<parameters_t, thread_count> thread_gradients;
-    for(int thread_id = 0; thread_id < thread_count; thread_id++)
+    const auto& entries = dataset.entries;
+    const auto team_size = team.thread_count();
+    vector<size_t> splits;
+    split_entries(entries, team_size, splits);
+    vector<uint32_t> order(entries.size());
+    iota(order.begin(), order.end(), 0);
+    cout << "Tuning with asynchronous SGD on " << team_size << " threads, learning rate " << async_learning_rate << endl;
+
+    auto learning_rate = static_cast<tune_t>(async_learning_rate);
+    const auto loop_start = high_resolution_clock::now();
+    ConvergenceMonitor monitor(loop_start);
+    parameters_t previous_parameters;
+    vector<CacheAligned<tune_t>> thread_errors(team_size);
+    for (int epoch = 1; epoch <= max_epoch; epoch++)
     {
-        thread_pool.enqueue([thread_id, &thread_gradients, &entries, &params, K]()
+        previous_parameters = parameters;
+        // d/dparameter (wdl - sigmoid)^2 = -2 * (wdl - sigmoid) * sigmoid * (1 - sigmoid) * K / 400 * coefficient * phase weight,
+        // the factor 2 is part of the learning rate
+        const auto step_scale = learning_rate * K / static_cast<tune_t>(400);
+        team.run([&](const uint32_t thread_id)
         {
-            const auto entries_per_thread = entries.size() / thread_count;
-            const auto start = static_cast<int>(thread_id * entries_per_thread);
-            const auto end = static_cast<int>((thread_id + 1) * entries_per_thread - 1);
+            auto& thread_error = thread_errors[thread_id].value;
+            thread_error = 0;
+            mt19937_64 generator(mini_batch_shuffle_seed + static_cast<uint64_t>(epoch) * team_size + thread_id);
+            shuffle(order.begin() + splits[thread_id], order.begin() + splits[thread_id + 1], generator);
+
+            thread_local vector<pair<int32_t, int32_t>> coefficients;
+            for (auto order_index = splits[thread_id]; order_index < splits[thread_id + 1]; order_index++)
+            {
+                const auto entry_index = order[order_index];
+                const auto& header = entries.headers[entry_index];
+                coefficients.clear();
+                decode_coefficients(entries.coefficients.data() + entries.offsets[entry_index], entries.coefficients.data() + entries.offsets[entry_index + 1],
+                                    [&](const int32_t value, const int32_t index)
+                {
+                    coefficients.emplace_back(value, index);
+                });
+
 #if TAPERED
-            parameters_t gradient = parameters_t(params.size(), pair_t{});
+                tune_t midgame = 0;
+                tune_t endgame = 0;
+                for (const auto& [value, index] : coefficients)
+                {
+                    midgame += value * atomic_ref<tune_t>(parameters[index][static_cast<int32_t>(PhaseStages::Midgame)]).load(memory_order_relaxed);
+                    endgame += value * atomic_ref<tune_t>(parameters[index][static_cast<int32_t>(PhaseStages::Endgame)]).load(memory_order_relaxed);
+                }
+                const auto eval = header.additional_score + midgame * header.midgame_weight + endgame * header.endgame_weight;
 #else
-            parameters_t gradient = parameters_t(params.size(), 0);
+                tune_t eval = header.additional_score;
+                for (const auto& [value, index] : coefficients)
+                {
+                    eval += value * atomic_ref<tune_t>(parameters[index]).load(memory_order_relaxed);
+                }
+#endif
+
+                const auto sig = sigmoid(K, eval);
+                const auto difference = header.get_wdl() - sig;
+                thread_error += difference * difference;
+                const auto step = step_scale * difference * sig * (1 - sig);
+#if TAPERED
+                const auto midgame_step = step * header.midgame_weight;
+                const auto endgame_step = step * header.endgame_weight;
+                for (const auto& [value, index] : coefficients)
+                {
+                    atomic_ref<tune_t> midgame_parameter(parameters[index][static_cast<int32_t>(PhaseStages::Midgame)]);
+                    atomic_ref<tune_t> endgame_parameter(parameters[index][static_cast<int32_t>(PhaseStages::Endgame)]);
+                    midgame_parameter.store(midgame_parameter.load(memory_order_relaxed) + value * midgame_step, memory_order_relaxed);
+                    endgame_parameter.store(endgame_parameter.load(memory_order_relaxed) + value * endgame_step, memory_order_relaxed);
+                }
+#else
+                for (const auto& [value, index] : coefficients)
+                {
+                    atomic_ref<tune_t> parameter(parameters[index]);
+                    parameter.store(parameter.load(memory_order_relaxed) + value * step, memory_order_relaxed);
+                }
 #endif
-            for (int i = start; i < end; i++)
-            {
-                const auto& entry = entries[i];
-                update_single_gradient(gradient, entry, params, K);
             }
-            thread_gradients[thread_id] = gradient;
         });
-    }
 
-    thread_pool.wait_for_completion();
+        // Each entry's error is taken right before its own update, so like the mean batch error of mini-batches this
+        // trails the parameters the epoch ends with, without another pass over the data set. No gradient is ever
+        // summed, so convergence_gradient_norm never stops asynchronous SGD
+        tune_t error = 0;
+        for (const auto& thread_error : thread_errors)
+        {
+            error += thread_error.value;
+        }
+        error /= static_cast<tune_t>(entries.size());
+        const auto stop_reason = monitor.update(error, numeric_limits<tune_t>::max(), previous_parameters, parameters, [&](const tune_t ratio)
+        {
+            learning_rate *= ratio;
+        });
 
-    for (int thread_id = 0; thread_id < thread_count; thread_id++)
-    {
-        for(auto parameter_index = 0; parameter_index < params.size(); parameter_index++)
+        if (epoch % 100 == 0 || epoch == max_epoch || stop_reason != nullptr)
         {
-#if TAPERED
-            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Midgame)] += thread_gradients[thread_id][parameter_index][static_cast<int32_t>(PhaseStages::Midgame)];
-            gradient[parameter_index][static_cast<int32_t>(PhaseStages::Endgame)] += thread_gradients[thread_id][parameter_index][static_cast<int32_t>(PhaseStages::Endgame)];
-#else
-            gradient[parameter_index] += thread_gradients[thread_id][parameter_index];
-#endif
+            const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - loop_start).count();
+            print_elapsed(start);
+            cout << "Epoch " << epoch << " (" << epoch * 1000.0 / max<int64_t>(elapsed_ms, 1) << " eps), mean entry error " << error << ", LR " << learning_rate << endl;
+            TuneEval::print_parameters(parameters);
         }
+        if (stop_reason != nullptr)
+        {
+            cout << "Stopping after epoch " << epoch << ", " << stop_reason << endl;
+            break;
+        }
+    }
+
+    cout << "Final error = " << get_average_error<tune_t>(team, dataset, parameters, K) << endl;
+}
+
+struct BenchmarkResult
+{
+    tune_t epochs_per_second;
+    tune_t error;
+};
+
+// Runs a fixed number of epochs from the same starting point, the error is always measured by the tune_t reference kernel
+template<typename Real>
+static BenchmarkResult benchmark_kernel(WorkerTeam& team, Dataset& dataset, parameters_t parameters, const tune_t K, const KernelIsa isa, const GradientEngine engine)
+{
+    kernel_isa = isa;
+    gradient_engine = engine;
+    const auto optimizer = make_optimizer(OptimizerType::Adam);
+    DatasetObjective<Real> objective(team, dataset, K);
+
+    const auto benchmark_start = high_resolution_clock::now();
+    for (int epoch = 0; epoch < benchmark_epochs; epoch++)
+    {
+        optimizer->step(objective, parameters);
     }
+    const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - benchmark_start).count();
+
+    BenchmarkResult result;
+    result.epochs_per_second = benchmark_epochs * 1000.0 / max<int64_t>(elapsed_ms, 1);
+    kernel_isa = KernelIsa::Scalar;
+    gradient_engine = GradientEngine::PositionMajor;
+    result.error = get_average_error<tune_t>(team, dataset, parameters, K);
+    return result;
 }
 
 void Tuner::run(const std::vector<DataSource>& sources)
@@ -703,7 +2215,10 @@ void Tuner::run(const std::vector<DataSource>& sources)
 
     cout << "Starting thread pool..." << endl;
     ThreadPool thread_pool;
-    thread_pool.start(thread_count);
+    thread_pool.start(get_thread_count());
+
+    kernel_isa = get_default_kernel_isa();
+    cout << "Using " << get_kernel_isa_name(kernel_isa) << " kernels" << endl;
 
     cout << "Getting initial parameters..." << endl;
     auto parameters = TuneEval::get_initial_parameters();
@@ -712,7 +2227,7 @@ void Tuner::run(const std::vector<DataSource>& sources)
     cout << "Initial parameters:" << endl;
     TuneEval::print_parameters(parameters);
 
-    vector<Entry> entries;
+    Dataset dataset;
 
     // Debug entry
     //const string debug_fen = "rnb1kbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQK1NR w KQkq - 0 1; 1.0";
@@ -723,104 +2238,171 @@ void Tuner::run(const std::vector<DataSource>& sources)
     //debug_entry.initial_eval = linear_eval(debug_entry, parameters);
     //entries.push_back(debug_entry);
 
-    for (const auto& source : sources)
-    {
-        load_fens(source, parameters, start, entries);
-    }
-    cout << "Data loading complete" << endl << endl;
+    load_dataset(thread_pool, sources, parameters, start, dataset);
+    // Loading hands out shards of uneven cost through the pool, the passes over the loaded data use the worker team
+    thread_pool.stop();
+    WorkerTeam team;
+    start_worker_team(team, dataset);
+    // Batches are gathered anew every step, there is no transposed copy of them to use. Asynchronous SGD takes
+    // precedence over mini-batches, it updates after every entry
+    const auto asynchronous = use_asynchronous_sgd(dataset);
+    const auto mini_batches = !asynchronous && use_mini_batches(dataset);
+    prepare_gradient_engine(dataset, parameters.size(), feature_major_gradient && !mini_batches && !asynchronous);
+    cout << "Using " << get_gradient_engine_name(gradient_engine) << " gradients" << endl;
 
-    print_statistics(parameters, entries);
+    print_statistics(parameters, dataset);
 
     if constexpr (retune_from_zero)
     {
-        for (auto& parameter : parameters)
-        {
-#if TAPERED
-            parameter[static_cast<int>(PhaseStages::Midgame)] = static_cast<tune_t>(0);
-            parameter[static_cast<int>(PhaseStages::Endgame)] = static_cast<tune_t>(0);
-#else
-            parameter = static_cast<tune_t>(0);
-#endif            
-        }
+        zero_parameters(parameters);
     }
 
     cout << "Initial parameters:" << endl;
     TuneEval::print_parameters(parameters);
 
-    tune_t K;
-    if constexpr (preferred_k <= 0)
+    const tune_t K = get_k(team, dataset, parameters);
+
+    if constexpr (least_squares_warm_start)
     {
-        cout << "Finding optimal K..." << endl;
-        K = find_optimal_k(thread_pool, entries, parameters);
+        warm_start_parameters(team, dataset, parameters, K);
+        cout << "Warm start parameters:" << endl;
+        TuneEval::print_parameters(parameters);
     }
-    else
+
+    if (asynchronous)
     {
-        cout << "Using predefined K = " << preferred_k <<  endl;
-        K = preferred_k;
+        tune_asynchronous(team, dataset, parameters, K, start);
+        team.stop();
+        return;
+    }
+
+    if (mini_batches)
+    {
+        tune_mini_batches(team, dataset, parameters, K, start);
+        team.stop();
+        return;
     }
-    cout << "K = " << K << endl;
 
-    const auto avg_error = get_average_error(thread_pool, entries, parameters, K);
-    cout << "Initial error = " << avg_error << endl;
+    cout << "Using " << get_optimizer_name(optimizer_type) << " optimizer" << endl;
+    const auto optimizer = make_optimizer(optimizer_type);
+    DatasetObjective<kernel_real_t> objective(team, dataset, K);
 
     const auto loop_start = high_resolution_clock::now();
-    tune_t learning_rate = 1;
+    ConvergenceMonitor monitor(loop_start);
+    tune_t report_epochs_per_second = 0;
+    string report_status;
+    parameters_t previous_parameters;
     int32_t max_tune_epoch = max_epoch;
-#if TAPERED
-    parameters_t momentum(parameters.size(), pair_t{});
-    parameters_t velocity(parameters.size(), pair_t{});
-#else
-    parameters_t momentum(parameters.size(), 0);
-    parameters_t velocity(parameters.size(), 0);
-#endif
-    for (int epoch = 1; epoch < max_tune_epoch; epoch++)
+    bool stopped_early = false;
+    // The error of the parameters an epoch ends with is only known from the first pass of the next epoch, so
+    // each report is printed one epoch late, and one more pass runs after the last epoch if it needs a report
+    for (int epoch = 1; epoch <= max_tune_epoch; epoch++)
     {
-#if TAPERED
-        parameters_t gradient(parameters.size(), pair_t{});
-#else
-        parameters_t gradient(parameters.size(), 0);
-#endif
-        
-        compute_gradient(thread_pool, gradient, entries, parameters, K);
+        const bool last_pass = epoch == max_tune_epoch;
+        const bool report_previous_epoch = epoch > 1 && ((epoch - 1) % 100 == 0 || (last_pass && stopped_early));
+        if (last_pass && epoch > 1 && !report_previous_epoch)
+        {
+            break;
+        }
 
-        constexpr tune_t beta1 = 0.9;
-        constexpr tune_t beta2 = 0.999;
+        // The step moves the parameters, the ones it started from are kept aside for the report and the monitor
+        previous_parameters = parameters;
 
-        for (int parameter_index = 0; parameter_index < parameters.size(); parameter_index++) {
-#if TAPERED
-            for(int phase_stage = 0; phase_stage < 2; phase_stage++)
-            {
-                const tune_t grad = -K / static_cast<tune_t>(400) * gradient[parameter_index][phase_stage] / static_cast<tune_t>(entries.size());
-                momentum[parameter_index][phase_stage] = beta1 * momentum[parameter_index][phase_stage] + (1 - beta1) * grad;
-                velocity[parameter_index][phase_stage] = beta2 * velocity[parameter_index][phase_stage] + (1 - beta2) * pow(grad, 2);
-                parameters[parameter_index][phase_stage] -= learning_rate * momentum[parameter_index][phase_stage] / (static_cast<tune_t>(1e-8) + sqrt(velocity[parameter_index][phase_stage]));
-            }
-#else
-            const tune_t grad = -K / 400.0 * gradient[parameter_index] / static_cast<tune_t>(entries.size());
-            momentum[parameter_index] = beta1 * momentum[parameter_index] + (1 - beta1) * grad;
-            velocity[parameter_index] = beta2 * velocity[parameter_index] + (1 - beta2) * pow(grad, 2);
-            parameters[parameter_index] -= learning_rate * momentum[parameter_index] / (1e-8 + sqrt(velocity[parameter_index]));
-#endif
-            
+        const tune_t error = last_pass ? objective.evaluate(parameters, nullptr) : optimizer->step(objective, parameters);
+        if (epoch == 1)
+        {
+            cout << "Initial error = " << error << endl;
         }
-
-        if (epoch % 100 == 0)
+        else if (report_previous_epoch)
         {
-            const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - loop_start).count();
-            const auto epochs_per_second = epoch * 1000.0 / elapsed_ms;
-            const tune_t error = get_average_error(thread_pool, entries, parameters, K);
             print_elapsed(start);
-            cout << "Epoch " << epoch << " (" << epochs_per_second << " eps), error " << error << ", LR " << learning_rate << endl;
-            TuneEval::print_parameters(parameters);
+            cout << "Epoch " << epoch - 1 << " (" << report_epochs_per_second << " eps), error " << error << ", " << report_status << endl;
+            TuneEval::print_parameters(previous_parameters);
+        }
+
+        if (last_pass)
+        {
+            break;
+        }
+
+        const auto stop_reason = monitor.update(error, objective.get_gradient_norm(), previous_parameters, parameters, *optimizer);
+        if (stop_reason != nullptr)
+        {
+            cout << "Stopping after epoch " << epoch << ", " << stop_reason << endl;
+            stopped_early = true;
+            max_tune_epoch = epoch + 1;
         }
 
-        constexpr int lr_drop_interval = 10000;
-        constexpr tune_t lr_drop_ratio = 1;
-        if(epoch % lr_drop_interval == 0)
+        if (epoch % 100 == 0 || stopped_early)
         {
-            learning_rate *= lr_drop_ratio;
+            const auto elapsed_ms = duration_cast<milliseconds>(high_resolution_clock::now() - loop_start).count();
+            report_epochs_per_second = epoch * 1000.0 / elapsed_ms;
+            report_status = optimizer->get_status();
         }
     }
 
+    team.stop();
+}
+
+void Tuner::benchmark(const std::vector<DataSource>& sources)
+{
+    cout << "Starting benchmark" << endl << endl;
+    const auto start = high_resolution_clock::now();
+
+    ThreadPool thread_pool;
+    thread_pool.start(get_thread_count());
+
+    auto parameters = TuneEval::get_initial_parameters();
+    Dataset dataset;
+    load_dataset(thread_pool, sources, parameters, start, dataset);
     thread_pool.stop();
+    WorkerTeam team;
+    start_worker_team(team, dataset);
+
+    if constexpr (retune_from_zero)
+    {
+        zero_parameters(parameters);
+    }
+
+    const tune_t K = get_k(team, dataset, parameters);
+
+    vector<KernelIsa> isas = {KernelIsa::Scalar};
+    if (get_default_kernel_isa() != KernelIsa::Scalar)
+    {
+        isas.push_back(get_default_kernel_isa());
+    }
+
+    // The position major runs cover every kernel, the feature major ones only the best kernel
+    prepare_gradient_engine(dataset, parameters.size(), true);
+    vector<pair<KernelIsa, GradientEngine>> configurations;
+    for (const auto isa : isas)
+    {
+        configurations.emplace_back(isa, GradientEngine::PositionMajor);
+    }
+    if (gradient_engine == GradientEngine::FeatureMajor)
+    {
+        configurations.emplace_back(isas.back(), GradientEngine::FeatureMajor);
+    }
+
+    cout << "Running " << benchmark_epochs << " epochs on " << dataset.size() << " entries with each kernel..." << endl;
+    BenchmarkResult reference{};
+    for (const auto& [isa, engine] : configurations)
+    {
+        for (const bool single : {false, true})
+        {
+            const auto result = single ? benchmark_kernel<float>(team, dataset, parameters, K, isa, engine)
+                                       : benchmark_kernel<double>(team, dataset, parameters, K, isa, engine);
+            if (isa == KernelIsa::Scalar && engine == GradientEngine::PositionMajor && !single)
+            {
+                reference = result;
+            }
+
+            const auto error_difference = fabs(result.error - reference.error);
+            cout << (single ? "float " : "double ") << get_kernel_isa_name(isa) << ", " << get_gradient_engine_name(engine) << ": " << result.epochs_per_second << " eps ("
+                 << result.epochs_per_second / reference.epochs_per_second << "x), error " << result.error << ", difference " << error_difference
+                 << (error_difference <= benchmark_error_tolerance ? " (within " : " (outside of ") << benchmark_error_tolerance << " tolerance)" << endl;
+        }
+    }
+
+    team.stop();
 }
@@ -15,6 +15,8 @@ namespace Tuner
     };
 
     void run(const std::vector<DataSource>& sources);
+    // Measures the epochs per second of the scalar and vectorized kernels in double and single precision on the same data set
+    void benchmark(const std::vector<DataSource>& sources);
 }
 
 #endif // !TUNER_H
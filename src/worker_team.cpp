@@ -0,0 +1,304 @@
+#include "worker_team.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Roughly tens of microseconds, longer than the gap between two passes but short enough that an idle team
+// soon stops taking CPU time from other processes
+constexpr uint32_t spin_count = 1 << 14;
+
+static void spin_pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    this_thread::yield();
+#endif
+}
+
+// Waits until value differs from old_value, spinning up to spin_limit times first and parking the thread afterwards
+static uint32_t wait_for_change(const atomic<uint32_t>& value, const uint32_t old_value, const uint32_t spin_limit)
+{
+    for (uint32_t spin = 0; spin < spin_limit; spin++)
+    {
+        const auto current = value.load(memory_order_acquire);
+        if (current != old_value)
+        {
+            return current;
+        }
+        spin_pause();
+    }
+
+    auto current = value.load(memory_order_acquire);
+    while (current == old_value)
+    {
+        value.wait(old_value, memory_order_acquire);
+        current = value.load(memory_order_acquire);
+    }
+    return current;
+}
+
+#if defined(__linux__)
+// CPUs the process may run on, in ascending order
+static vector<int> get_allowed_cpus()
+{
+    vector<int> cpus;
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &cpu_set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    return cpus;
+}
+
+// Parses a cpulist like "0-3,8,10-11" from sysfs
+static vector<int> parse_cpu_list(const string& list)
+{
+    vector<int> cpus;
+    stringstream ss(list);
+    string part;
+    while (getline(ss, part, ','))
+    {
+        int first = 0;
+        int last = 0;
+        const auto matched = sscanf(part.c_str(), "%d-%d", &first, &last);
+        if (matched < 1)
+        {
+            continue;
+        }
+        for (int cpu = first; cpu <= (matched == 2 ? last : first); cpu++)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// Orders the CPUs so that consecutive ones sit on different NUMA nodes in turn: the first CPU of every node,
+// then the second of every node and so on. Pinning thread i to the i-th of them spreads any number of threads,
+// and the entries they place, over the memory controllers of all sockets. CPUs sysfs does not list keep their
+// order after the rest
+static vector<int> interleave_numa_nodes(const vector<int>& cpus)
+{
+    vector<pair<int, vector<int>>> nodes;
+    error_code error;
+    for (filesystem::directory_iterator it("/sys/devices/system/node", error), end; !error && it != end; it.increment(error))
+    {
+        const auto name = it->path().filename().string();
+        int node = 0;
+        if (!name.starts_with("node") || sscanf(name.c_str(), "node%d", &node) != 1)
+        {
+            continue;
+        }
+        ifstream file(it->path() / "cpulist");
+        string list;
+        getline(file, list);
+        vector<int> node_cpus;
+        for (const auto cpu : parse_cpu_list(list))
+        {
+            if (find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+            {
+                node_cpus.push_back(cpu);
+            }
+        }
+        if (!node_cpus.empty())
+        {
+            nodes.emplace_back(node, move(node_cpus));
+        }
+    }
+    if (nodes.size() < 2)
+    {
+        return cpus;
+    }
+    sort(nodes.begin(), nodes.end());
+
+    vector<int> interleaved;
+    for (size_t index = 0; interleaved.size() < cpus.size(); index++)
+    {
+        bool any_left = false;
+        for (const auto& [node, node_cpus] : nodes)
+        {
+            if (index < node_cpus.size())
+            {
+                interleaved.push_back(node_cpus[index]);
+                any_left = true;
+            }
+        }
+        if (!any_left)
+        {
+            break;
+        }
+    }
+    for (const auto cpu : cpus)
+    {
+        if (find(interleaved.begin(), interleaved.end(), cpu) == interleaved.end())
+        {
+            interleaved.push_back(cpu);
+        }
+    }
+    return interleaved;
+}
+
+static bool pin_thread(const pthread_t thread, const int cpu)
+{
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set) == 0;
+}
+#endif
+
+WorkerTeam::~WorkerTeam()
+{
+    stop();
+}
+
+void WorkerTeam::start(const uint32_t thread_count, const bool pin_threads)
+{
+    stop();
+    should_stop.store(false, memory_order_relaxed);
+    team_size = max<uint32_t>(thread_count, 1);
+    // With more threads than cores a spinning thread only delays the ones that still have work
+    spin_limit = team_size <= thread::hardware_concurrency() ? spin_count : 0;
+    workers = vector<Worker>(team_size);
+    // Read before any thread exists, so a job handed out right after start() is never missed
+    const auto start_generation = generation.load(memory_order_relaxed);
+    for (uint32_t thread_id = 1; thread_id < team_size; thread_id++)
+    {
+        workers[thread_id].thread = thread([this, thread_id, start_generation]()
+        {
+            thread_loop(thread_id, start_generation);
+        });
+    }
+
+    if (!pin_threads)
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    const auto cpus = interleave_numa_nodes(get_allowed_cpus());
+    if (cpus.empty())
+    {
+        cout << "Failed to read the CPU affinity, threads are not pinned" << endl;
+        return;
+    }
+
+    caller_pinned = pthread_getaffinity_np(pthread_self(), sizeof(caller_affinity), &caller_affinity) == 0;
+    threads_pinned = caller_pinned && pin_thread(pthread_self(), cpus[0]);
+    for (uint32_t thread_id = 1; thread_id < team_size; thread_id++)
+    {
+        threads_pinned &= pin_thread(workers[thread_id].thread.native_handle(), cpus[thread_id % cpus.size()]);
+    }
+    if (!threads_pinned)
+    {
+        cout << "Failed to pin every thread to its CPU" << endl;
+    }
+#else
+    cout << "Pinning threads is not supported on this platform" << endl;
+#endif
+}
+
+uint32_t WorkerTeam::thread_count() const
+{
+    return team_size;
+}
+
+bool WorkerTeam::are_threads_pinned() const
+{
+    return threads_pinned;
+}
+
+void WorkerTeam::stop()
+{
+    if (workers.empty())
+    {
+        return;
+    }
+
+    should_stop.store(true, memory_order_relaxed);
+    generation.fetch_add(1, memory_order_release);
+    generation.notify_all();
+    for (auto& worker : workers)
+    {
+        if (worker.thread.joinable())
+        {
+            worker.thread.join();
+        }
+    }
+    workers.clear();
+    team_size = 1;
+
+#if defined(__linux__)
+    if (caller_pinned)
+    {
+        pthread_setaffinity_np(pthread_self(), sizeof(caller_affinity), &caller_affinity);
+        caller_pinned = false;
+    }
+#endif
+    threads_pinned = false;
+}
+
+void WorkerTeam::run_job(const job_t job, void* context)
+{
+    for (uint32_t thread_id = 1; thread_id < team_size; thread_id++)
+    {
+        workers[thread_id].job = job;
+        workers[thread_id].context = context;
+    }
+
+    pending_workers.store(team_size - 1, memory_order_relaxed);
+    generation.fetch_add(1, memory_order_release);
+    generation.notify_all();
+
+    job(context, 0);
+
+    auto pending = pending_workers.load(memory_order_acquire);
+    while (pending != 0)
+    {
+        pending = wait_for_change(pending_workers, pending, spin_limit);
+    }
+}
+
+void WorkerTeam::thread_loop(const uint32_t thread_id, uint32_t seen_generation)
+{
+    while (true)
+    {
+        seen_generation = wait_for_change(generation, seen_generation, spin_limit);
+        if (should_stop.load(memory_order_relaxed))
+        {
+            return;
+        }
+
+        const auto& worker = workers[thread_id];
+        worker.job(worker.context, thread_id);
+
+        if (pending_workers.fetch_sub(1, memory_order_acq_rel) == 1)
+        {
+            pending_workers.notify_one();
+        }
+    }
+}
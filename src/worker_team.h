@@ -0,0 +1,79 @@
+#ifndef WORKER_TEAM_H
+#define WORKER_TEAM_H 1
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+constexpr size_t cache_line_size = 64;
+
+// Keeps a per thread value on its own cache line, so threads updating neighbouring values never share a line
+template<typename T>
+struct alignas(cache_line_size) CacheAligned
+{
+    T value{};
+};
+
+// A fixed team of threads for fork-join passes over the data set. run() hands a job to every thread and returns
+// once all of them finished it, the calling thread takes part as thread 0. Waiting threads spin for a short
+// while before they park, so the back to back passes of an epoch rarely pay for a wake up
+class WorkerTeam
+{
+public:
+    ~WorkerTeam();
+    // With pin_threads set, thread i only runs on the i-th CPU the process may use (wrapping around), the calling
+    // thread included until stop(). The CPUs are taken from the NUMA nodes in turn, so that fewer threads than
+    // CPUs still use the memory bandwidth of every socket. Only supported on Linux, elsewhere threads are never
+    // pinned
+    void start(uint32_t thread_count, bool pin_threads = false);
+    uint32_t thread_count() const;
+    bool are_threads_pinned() const;
+    void stop();
+
+    // Calls job(thread_id) once for every thread_id below thread_count(), in parallel
+    template<typename F>
+    void run(F&& job)
+    {
+        using job_type = std::remove_reference_t<F>;
+        run_job([](void* context, const uint32_t thread_id)
+        {
+            (*static_cast<job_type*>(context))(thread_id);
+        }, const_cast<void*>(static_cast<const void*>(&job)));
+    }
+
+private:
+    using job_t = void (*)(void* context, uint32_t thread_id);
+
+    // Work descriptor of a thread, written before the generation is bumped and read after it changed
+    struct alignas(cache_line_size) Worker
+    {
+        std::thread thread;
+        job_t job = nullptr;
+        void* context = nullptr;
+    };
+
+    std::vector<Worker> workers;
+    uint32_t team_size = 1;
+    uint32_t spin_limit = 0;
+    alignas(cache_line_size) std::atomic<uint32_t> generation = 0;
+    alignas(cache_line_size) std::atomic<uint32_t> pending_workers = 0;
+    std::atomic<bool> should_stop = false;
+    bool threads_pinned = false;
+#if defined(__linux__)
+    // Affinity of the calling thread before it was pinned, restored by stop()
+    cpu_set_t caller_affinity;
+    bool caller_pinned = false;
+#endif
+
+    void run_job(job_t job, void* context);
+    void thread_loop(uint32_t thread_id, uint32_t seen_generation);
+};
+
+#endif // !WORKER_TEAM_H